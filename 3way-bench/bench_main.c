@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// BENCHMARK HARNESS
+// Runs the three backends over a matrix of thread counts and input sizes on
+// this machine, without Slurm. Every point gets warmup runs and then reps
+// timed runs, and the median and p95 of the time each run writes to its
+// times file are reported with throughput, speedup and parallel efficiency
+// as a table on stdout, a CSV file and a JSON file.
+//
+// The input is a synthetic dump generated once with wiki-like line lengths,
+// or the first lines of a real one (--input=path). MPI gets threads ranks.
+
+#define MAX_MATRIX 32      // Most thread counts, sizes or reps in one run
+#define DEFAULT_REPS 5
+#define DEFAULT_WARMUP 1
+#define DATA_PATH "bench-data.txt"   // Synthetic input, generated when missing or too short
+#define TIMES_PATH "bench-times.txt" // Times file every run writes
+
+typedef struct
+{
+    const char *name;
+    const char *exc; // Executable, relative to 3way-bench
+    int mpi;         // Started with mpirun -np threads
+} backend;
+
+static backend backends[] = {
+    {"pthread", "../3way-pthread/pthread-exc", 0},
+    {"openmp", "../3way-openmp/openmp-exc", 0},
+    {"mpi", "../3way-mpi/mpi-exc", 1},
+};
+#define BACKENDS (int)(sizeof(backends) / sizeof(backends[0]))
+
+// One point of the matrix
+typedef struct
+{
+    const char *backend;
+    int threads;
+    long lines;
+    size_t bytes;
+    double median, p95;  // Seconds the backend reported
+    double wall_median;  // Seconds from fork to exit, process (and mpirun) startup included
+    double speedup;      // Against the fewest threads of the same backend and size
+    double efficiency;   // speedup per thread, 1 is linear scaling
+} bench_result;
+
+// Settings from the command line
+int use_backend[BACKENDS] = {1, 1, 1};
+int thread_counts[MAX_MATRIX] = {1, 2, 4, 8, 16};
+int thread_count_n = 5;
+long sizes[MAX_MATRIX] = {1000, 10000, 100000, 1000000};
+int size_n = 4;
+int reps = DEFAULT_REPS;
+int warmup = DEFAULT_WARMUP;
+const char *input_path = NULL; // NULL for the synthetic dump
+const char *csv_path = "bench.csv";
+const char *json_path = "bench.json";
+const char *mpirun = "mpirun";
+const char *hostfile = NULL;
+
+// Seconds on the monotonic clock
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+// Positive count with an optional k or m suffix (1k, 100k, 1m), -1 if it is not one
+long parse_count(const char *text)
+{
+    char *end;
+    long n = strtol(text, &end, 10);
+
+    if (*end == 'k' || *end == 'K')
+    {
+        n *= 1000;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        n *= 1000000;
+        end++;
+    }
+
+    return (end == text || *end != '\0' || n <= 0) ? -1 : n;
+}
+
+// Comma separated counts into list, sorted ascending. Returns how many, -1 on a bad one.
+int parse_list(const char *text, long *list)
+{
+    char copy[1024], *save;
+    int n = 0;
+
+    snprintf(copy, sizeof(copy), "%s", text);
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        long value = parse_count(item);
+        if (value < 0 || n == MAX_MATRIX)
+            return -1;
+
+        // Insertion sort, the lists are short
+        int i = n++;
+        while (i > 0 && list[i - 1] > value)
+        {
+            list[i] = list[i - 1];
+            i--;
+        }
+        list[i] = value;
+    }
+
+    return n > 0 ? n : -1;
+}
+
+// GENERATE INPUT
+// Writes lines lines with lengths shaped like the wiki dump: a third short
+// or empty, most a few hundred bytes, a few paragraphs of several KB. Most
+// bytes are printable ASCII with some UTF-8 (values up to 255) mixed in.
+// The same seed always gives the same file.
+int generate_input(const char *path, long lines)
+{
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    char line[16384];
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    for (long i = 0; i < lines; i++)
+    {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        int kind = state % 100;
+        size_t length;
+        if (kind < 30)
+            length = (state >> 8) % 16;
+        else if (kind < 92)
+            length = 40 + (state >> 8) % 900;
+        else
+            length = 1000 + (state >> 8) % (sizeof(line) - 1000);
+
+        for (size_t j = 0; j < length; j++)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            line[j] = (state % 200 == 0) ? (char)(0xC0 + (state >> 16) % 64) : (char)(' ' + (state >> 8) % 95);
+        }
+        line[length] = '\n';
+
+        if (fwrite(line, 1, length + 1, fp) != length + 1)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    return fclose(fp);
+}
+
+// Bytes in the first sizes[i] lines of path, for every size. Returns the lines the file has.
+long measure_input(const char *path, size_t *bytes)
+{
+    char *line = NULL;
+    size_t len = 0, total = 0;
+    ssize_t read;
+    long lines = 0;
+    int next = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    while (next < size_n && (read = getline(&line, &len, fp)) != -1)
+    {
+        total += read;
+        lines++;
+        while (next < size_n && sizes[next] == lines)
+            bytes[next++] = total;
+    }
+
+    // Sizes past the end of the file read all of it
+    while (next < size_n)
+        bytes[next++] = total;
+
+    free(line);
+    fclose(fp);
+    return lines;
+}
+
+// RUN ONCE
+// Runs one backend with its output going to /dev/null. Sets *reported to
+// the Time: the backend wrote to its times file and *wall to the time
+// until it exited. Returns 0, or -1 if it failed.
+int run_once(const backend *b, int threads, long lines, const char *input, double *reported, double *wall)
+{
+    char threads_arg[32], lines_arg[32], np[16];
+    const char *argv[16];
+    int argc = 0;
+
+    snprintf(threads_arg, sizeof(threads_arg), "--threads=%d", threads);
+    snprintf(lines_arg, sizeof(lines_arg), "--lines=%ld", lines);
+    snprintf(np, sizeof(np), "%d", threads);
+
+    if (b->mpi)
+    {
+        argv[argc++] = mpirun;
+        if (geteuid() == 0)
+            argv[argc++] = "--allow-run-as-root";
+        argv[argc++] = "--oversubscribe";
+        if (hostfile != NULL)
+        {
+            argv[argc++] = "--hostfile";
+            argv[argc++] = hostfile;
+        }
+        argv[argc++] = "-np";
+        argv[argc++] = np;
+    }
+    argv[argc++] = b->exc;
+    argv[argc++] = TIMES_PATH;
+    if (!b->mpi)
+        argv[argc++] = threads_arg;
+    argv[argc++] = lines_arg;
+    argv[argc++] = input;
+    argv[argc] = NULL;
+
+    remove(TIMES_PATH);
+    double start = now();
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+    {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0)
+            dup2(fd, STDOUT_FILENO);
+        execvp(argv[0], (char **)argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    *wall = now() - start;
+
+    FILE *fp = fopen(TIMES_PATH, "r");
+    if (fp == NULL)
+        return -1;
+    int found = fscanf(fp, "Time: %lfs", reported);
+    fclose(fp);
+    return found == 1 ? 0 : -1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median and nearest-rank 95th percentile of n samples (sorts them)
+void summarize(double *samples, int n, double *median, double *p95)
+{
+    qsort(samples, n, sizeof(double), compare_double);
+    *median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+    int rank = (95 * n + 99) / 100; // ceil(0.95 n)
+    *p95 = samples[rank > 0 ? rank - 1 : 0];
+}
+
+void write_csv(FILE *fp, const bench_result *results, int count)
+{
+    fprintf(fp, "backend,threads,lines,bytes,reps,median_s,p95_s,wall_median_s,mb_per_s,lines_per_s,speedup,efficiency\n");
+    for (int i = 0; i < count; i++)
+    {
+        const bench_result *r = &results[i];
+        fprintf(fp, "%s,%d,%ld,%zu,%d,%.6f,%.6f,%.6f,%.2f,%.0f,%.3f,%.3f\n", r->backend, r->threads, r->lines, r->bytes,
+                reps, r->median, r->p95, r->wall_median, r->bytes / r->median / 1e6, r->lines / r->median, r->speedup,
+                r->efficiency);
+    }
+}
+
+void write_json(FILE *fp, const bench_result *results, int count, const char *input)
+{
+    fprintf(fp, "{\n  \"input\": \"%s\",\n  \"reps\": %d,\n  \"warmup\": %d,\n  \"results\": [\n", input, reps, warmup);
+    for (int i = 0; i < count; i++)
+    {
+        const bench_result *r = &results[i];
+        fprintf(fp,
+                "    {\"backend\": \"%s\", \"threads\": %d, \"lines\": %ld, \"bytes\": %zu, \"median_s\": %.6f, "
+                "\"p95_s\": %.6f, \"wall_median_s\": %.6f, \"mb_per_s\": %.2f, \"lines_per_s\": %.0f, "
+                "\"speedup\": %.3f, \"efficiency\": %.3f}%s\n",
+                r->backend, r->threads, r->lines, r->bytes, r->median, r->p95, r->wall_median,
+                r->bytes / r->median / 1e6, r->lines / r->median, r->speedup, r->efficiency, i + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--backends=pthread,openmp,mpi] [--threads=1,2,4,8,16] [--sizes=1k,10k,100k,1m]\n"
+            "       [--reps=N] [--warmup=N] [--input=file] [--csv=file] [--json=file] [--mpirun=cmd] [--hostfile=file]\n",
+            program);
+}
+
+// Value of --name=value if arg is that option, NULL otherwise
+const char *option_value(const char *arg, const char *name)
+{
+    size_t length = strlen(name);
+
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+
+    return NULL;
+}
+
+int parse_args(int argc, char *args[])
+{
+    const char *value;
+    long list[MAX_MATRIX];
+    int n;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((value = option_value(args[i], "--backends")) != NULL)
+        {
+            memset(use_backend, 0, sizeof(use_backend));
+            for (int b = 0; b < BACKENDS; b++)
+            {
+                const char *found = strstr(value, backends[b].name);
+                size_t length = strlen(backends[b].name);
+                if (found != NULL && (found == value || found[-1] == ',') && (found[length] == ',' || found[length] == '\0'))
+                    use_backend[b] = 1;
+            }
+        }
+        else if ((value = option_value(args[i], "--threads")) != NULL)
+        {
+            if ((n = parse_list(value, list)) < 0)
+                return -1;
+            for (int j = 0; j < n; j++)
+                thread_counts[j] = list[j];
+            thread_count_n = n;
+        }
+        else if ((value = option_value(args[i], "--sizes")) != NULL)
+        {
+            if ((size_n = parse_list(value, sizes)) < 0)
+                return -1;
+        }
+        else if ((value = option_value(args[i], "--reps")) != NULL)
+        {
+            if ((reps = parse_count(value)) < 0 || reps > MAX_MATRIX)
+                return -1;
+        }
+        else if ((value = option_value(args[i], "--warmup")) != NULL)
+        {
+            if ((warmup = atoi(value)) < 0)
+                return -1;
+        }
+        else if ((value = option_value(args[i], "--input")) != NULL)
+            input_path = value;
+        else if ((value = option_value(args[i], "--csv")) != NULL)
+            csv_path = value;
+        else if ((value = option_value(args[i], "--json")) != NULL)
+            json_path = value;
+        else if ((value = option_value(args[i], "--mpirun")) != NULL)
+            mpirun = value;
+        else if ((value = option_value(args[i], "--hostfile")) != NULL)
+            hostfile = value;
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+// MAIN FUNCTION
+// Prepares the input, runs the matrix and writes the reports
+int main(int argc, char *args[])
+{
+    size_t bytes[MAX_MATRIX];
+    double samples[MAX_MATRIX], walls[MAX_MATRIX];
+
+    if (parse_args(argc, args) != 0)
+    {
+        usage(args[0]);
+        exit(1);
+    }
+
+    // Generate the synthetic dump once, big enough for the largest size
+    const char *input = input_path != NULL ? input_path : DATA_PATH;
+    long available = measure_input(input, bytes);
+    if (input_path == NULL && available < sizes[size_n - 1])
+    {
+        fprintf(stderr, "Generating %ld lines of synthetic input in %s\n", sizes[size_n - 1], DATA_PATH);
+        if (generate_input(DATA_PATH, sizes[size_n - 1]) != 0)
+        {
+            perror("Error writing the synthetic input");
+            exit(1);
+        }
+        available = measure_input(input, bytes);
+    }
+    if (available < 0)
+    {
+        perror("Error reading the input");
+        exit(1);
+    }
+
+    bench_result *results = calloc(BACKENDS * size_n * thread_count_n, sizeof(bench_result));
+    if (results == NULL)
+    {
+        perror("Error allocating the results");
+        exit(1);
+    }
+    int count = 0;
+
+    printf("%-8s %7s %9s %12s %10s %10s %10s %9s %12s %8s %6s\n", "backend", "threads", "lines", "bytes", "median_s",
+           "p95_s", "wall_s", "MB/s", "lines/s", "speedup", "eff");
+
+    for (int b = 0; b < BACKENDS; b++)
+    {
+        if (!use_backend[b])
+            continue;
+        if (access(backends[b].exc, X_OK) != 0)
+        {
+            fprintf(stderr, "Skipping %s: %s is not built\n", backends[b].name, backends[b].exc);
+            continue;
+        }
+
+        for (int s = 0; s < size_n; s++)
+        {
+            long lines = sizes[s] < available ? sizes[s] : available;
+            bench_result *baseline = NULL;
+
+            for (int t = 0; t < thread_count_n; t++)
+            {
+                bench_result *r = &results[count];
+                double reported, wall;
+                int failed = 0;
+
+                for (int i = 0; i < warmup + reps && !failed; i++)
+                {
+                    failed = run_once(&backends[b], thread_counts[t], lines, input, &reported, &wall) != 0;
+                    if (i >= warmup)
+                    {
+                        samples[i - warmup] = reported;
+                        walls[i - warmup] = wall;
+                    }
+                }
+                if (failed)
+                {
+                    fprintf(stderr, "%s failed with %d threads on %ld lines\n", backends[b].name, thread_counts[t], lines);
+                    continue;
+                }
+
+                r->backend = backends[b].name;
+                r->threads = thread_counts[t];
+                r->lines = lines;
+                r->bytes = bytes[s];
+                summarize(samples, reps, &r->median, &r->p95);
+                summarize(walls, reps, &r->wall_median, &wall);
+
+                // Thread counts are sorted, so the first one that ran is the baseline
+                if (baseline == NULL)
+                    baseline = r;
+                r->speedup = baseline->median / r->median;
+                r->efficiency = r->speedup * baseline->threads / r->threads;
+
+                printf("%-8s %7d %9ld %12zu %10.6f %10.6f %10.6f %9.2f %12.0f %8.3f %6.3f\n", r->backend, r->threads,
+                       r->lines, r->bytes, r->median, r->p95, r->wall_median, r->bytes / r->median / 1e6,
+                       r->lines / r->median, r->speedup, r->efficiency);
+                fflush(stdout);
+                count++;
+            }
+        }
+    }
+
+    remove(TIMES_PATH);
+
+    FILE *csv = fopen(csv_path, "w");
+    FILE *json = fopen(json_path, "w");
+    if (csv == NULL || json == NULL)
+    {
+        perror("Error opening the report files");
+        exit(1);
+    }
+    write_csv(csv, results, count);
+    write_json(json, results, count, input);
+    fclose(csv);
+    fclose(json);
+
+    free(results);
+    return 0;
+}
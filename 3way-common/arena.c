@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "trace.h"
+
+// ARENA INIT
+void arena_init(arena *a, size_t initial_size)
+{
+    memset(a, 0, sizeof(*a));
+    a->capacity = initial_size > 0 ? initial_size : ARENA_INITIAL_SIZE;
+}
+
+// ARENA ALLOC
+// Bumps used. The region is only allocated on first use, and doubled
+// (keeping what is in it) when the request does not fit.
+char *arena_alloc(arena *a, size_t size)
+{
+    if (a->base == NULL || a->capacity - a->used < size)
+    {
+        size_t capacity = a->capacity;
+        while (capacity - a->used < size)
+            capacity *= 2;
+
+        char *temp = realloc(a->base, capacity);
+        if (temp == NULL)
+            return NULL;
+
+        a->base = temp;
+        a->capacity = capacity;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    char *p = a->base + a->used;
+    a->used += size;
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+
+    return p;
+}
+
+// ARENA RESET
+void arena_reset(arena *a)
+{
+    a->used = 0;
+}
+
+// ARENA FREE
+void arena_free(arena *a)
+{
+    free(a->base);
+    a->base = NULL;
+    a->used = 0;
+}
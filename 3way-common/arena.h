@@ -0,0 +1,37 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_INITIAL_SIZE (1 << 20) // First allocation, doubled whenever a batch needs more
+
+// ARENA
+// Bump-pointer region for the line bytes of one batch. Lines are appended
+// back to back, so the whole batch is one contiguous buffer, and it is
+// given back with arena_reset in O(1). When the region is full it doubles
+// and moves, so callers keep offsets from base instead of pointers. The
+// region is kept between batches and stops growing after the first few.
+
+typedef struct
+{
+    char *base;        // Start of the region, moves when it grows
+    size_t used;       // Bytes handed out since the last reset
+    size_t capacity;   // Bytes allocated from malloc
+    size_t high_water; // Largest used ever seen, what a batch really needs
+} arena;
+
+// Set up an empty arena, nothing is allocated until the first arena_alloc
+void arena_init(arena *a, size_t initial_size);
+
+// size more bytes right behind the previous allocation, NULL when out of
+// memory. The pointer is valid until the next arena_alloc, the offset
+// from base until the next reset.
+char *arena_alloc(arena *a, size_t size);
+
+// Forget every allocation, keeping the region for reuse
+void arena_reset(arena *a);
+
+// Give the region back to malloc
+void arena_free(arena *a);
+
+#endif
@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+
+int batch_value_fields = 1;
+
+// BATCH PART
+// Splits whole cache lines of results evenly, the last part gets the tail
+void batch_part(long lines, int part, int parts, long *start, long *end)
+{
+    long units = (lines + VALUES_PER_CACHE_LINE - 1) / VALUES_PER_CACHE_LINE;
+
+    *start = part * units / parts * VALUES_PER_CACHE_LINE;
+    *end = (part + 1) * units / parts * VALUES_PER_CACHE_LINE;
+
+    if (*start > lines)
+        *start = lines;
+    if (*end > lines)
+        *end = lines;
+}
+
+// BATCH VALUES ALLOC
+int *batch_values_alloc(long capacity)
+{
+    size_t size = capacity * batch_value_fields * sizeof(int);
+
+    // aligned_alloc wants a multiple of the alignment
+    size = (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    return aligned_alloc(CACHE_LINE, size > 0 ? size : CACHE_LINE);
+}
+
+// BATCH COPY LINES
+int batch_copy_lines(line_batch *batch, long lines)
+{
+    size_t size = batch->line_offsets[lines];
+    char *copy = arena_alloc(&batch->arena, size);
+    if (copy == NULL)
+        return -1;
+
+    memcpy(copy, batch->bytes, size);
+    for (long i = 0; i < lines; i++)
+    {
+        char *line = copy + batch->line_offsets[i];
+        size_t length = batch->line_offsets[i + 1] - batch->line_offsets[i];
+        char *nul = memchr(line, '\0', length);
+        if (nul != NULL)
+            memset(nul, 0, line + length - nul);
+    }
+
+    batch->bytes = copy;
+    batch->zeroed = 1;
+    return 0;
+}
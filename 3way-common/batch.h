@@ -0,0 +1,63 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "arena.h"
+
+#define CACHE_LINE 64 // Bytes per cache line
+#define VALUES_PER_CACHE_LINE (long)(CACHE_LINE / sizeof(int))
+
+// LINE BATCH
+// One batch of lines and its results. Several batches are in flight at
+// once in the pipeline, so everything a stage needs lives in here.
+//
+// The lines are stored as a struct of arrays that all three backends read
+// the same way: the bytes of every line back to back in one buffer, and
+// lines + 1 offsets into it, so line i is
+//
+//     bytes + line_offsets[i], line_offsets[i + 1] - line_offsets[i] bytes long
+//
+// (newline included). Workers walk the buffer front to back instead of
+// chasing a pointer per line. A batch holds less than 4 GiB of lines.
+typedef struct
+{
+    long offset;            // Line number of the first line in the batch
+    long lines;             // Number of lines in the batch (0 marks the end of the input)
+    const char *bytes;      // Line bytes: the arena in getline mode, the mapping in mmap mode
+    uint32_t *line_offsets; // lines + 1 offsets into bytes
+    size_t file_offset;     // File offset of bytes[0]
+    arena arena;            // Line bytes copied with getline, reset when the batch is read again
+    int zeroed;             // bytes is a copy with the bytes after an embedded NUL zeroed, not the file's
+    int *max_values;        // Max ASCII value per line (batch_value_fields values with --stats), starts on a cache line
+    char *output;           // Formatted results, rendered before the writer stage
+    size_t output_length;   // Bytes in output when it is one part (MPI text gather)
+    size_t output_capacity;
+    struct iovec *output_parts; // Per-worker slices of output, written in order with writev
+    int output_part_count;
+    const char *placed_base; // Arena topology_place_batch last bound to the workers' nodes
+    size_t placed_bytes;     // Batch size it was bound for
+    double read_time;       // Seconds the read stage spent on the last fill
+    double compute_time;    // Seconds the compute stage spent on it
+} line_batch;
+
+// Results per line in max_values: 1, the max ASCII value, unless --stats
+// asks for more (line_stats.h). Set once before any batch is allocated;
+// line i's results start at max_values[i * batch_value_fields].
+extern int batch_value_fields;
+
+// Lines [start, end) of part out of parts. Every boundary falls on a
+// cache line of max_values, so two workers never write the same line.
+void batch_part(long lines, int part, int parts, long *start, long *end);
+
+// max_values for capacity lines of batch_value_fields, aligned and padded to whole cache lines
+int *batch_values_alloc(long capacity);
+
+// Copy lines lines at bytes (mmap mode) into the batch's arena the way
+// getline mode reads them, anything after an embedded NUL as 0, point
+// bytes there and set zeroed. Returns 0, or -1 when out of memory.
+int batch_copy_lines(line_batch *batch, long lines);
+
+#endif
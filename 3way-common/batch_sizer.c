@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "batch_sizer.h"
+#include "out_writer.h"
+
+// Per-line memory besides the line itself: its offset, its results and their rendered text
+#define BATCH_LINE_OVERHEAD (sizeof(uint32_t) + batch_value_fields * sizeof(int) + format_line_max())
+
+// The lower of two limits where 0 means no limit
+static size_t lower_limit(size_t a, size_t b)
+{
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+    return a < b ? a : b;
+}
+
+// Limit in a cgroup file, 0 for "max" (v2), a huge number (v1) or no file
+static size_t read_limit(const char *path)
+{
+    char text[64];
+    size_t limit = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+
+    if (fgets(text, sizeof(text), fp) != NULL)
+    {
+        char *end;
+        unsigned long long n = strtoull(text, &end, 10);
+        if (end != text && n < (1ULL << 60))
+            limit = n;
+    }
+
+    fclose(fp);
+    return limit;
+}
+
+// Lowest limit in file of the cgroup at path under root and of its parents.
+// Slurm puts the job's limit on the job cgroup, the step below it has none.
+static size_t cgroup_limit(const char *root, char *path, const char *file)
+{
+    char full[PATH_MAX];
+    size_t lowest = 0;
+
+    while (1)
+    {
+        snprintf(full, sizeof(full), "%s%s/%s", root, strcmp(path, "/") == 0 ? "" : path, file);
+        lowest = lower_limit(lowest, read_limit(full));
+
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || strcmp(path, "/") == 0)
+            break;
+        if (slash == path)
+            path[1] = '\0';
+        else
+            *slash = '\0';
+    }
+
+    return lowest;
+}
+
+// Memory limit of this process's cgroups, from /proc/self/cgroup lines
+// "id:controllers:path" (v2 has one line with no controllers)
+static size_t cgroup_memory_limit(void)
+{
+    char line[PATH_MAX + 64];
+    size_t lowest = 0;
+
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *controllers = strchr(line, ':');
+        char *path = controllers == NULL ? NULL : strchr(controllers + 1, ':');
+        if (path == NULL)
+            continue;
+        *path++ = '\0';
+        controllers++;
+
+        if (*controllers == '\0')
+        {
+            lowest = lower_limit(lowest, cgroup_limit("/sys/fs/cgroup", path, "memory.max"));
+            continue;
+        }
+
+        char *save;
+        for (char *name = strtok_r(controllers, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+        {
+            if (strcmp(name, "memory") == 0)
+                lowest = lower_limit(lowest, cgroup_limit("/sys/fs/cgroup/memory", path, "memory.limit_in_bytes"));
+        }
+    }
+
+    fclose(fp);
+    return lowest;
+}
+
+// Soft limit of resource, 0 if unlimited
+static size_t rlimit_bytes(int resource)
+{
+    struct rlimit limit;
+
+    if (getrlimit(resource, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+        return 0;
+    return limit.rlim_cur;
+}
+
+// Take limit as the budget if it is lower than what was found so far
+static void lower_budget(size_t *budget, const char **source, size_t limit, const char *name)
+{
+    if (limit != 0 && (*budget == 0 || limit < *budget))
+    {
+        *budget = limit;
+        *source = name;
+    }
+}
+
+// MEMORY BUDGET DETECT
+size_t memory_budget_detect(const char **source)
+{
+    size_t budget = 0;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    *source = "fallback";
+    if (pages > 0 && page_size > 0)
+        lower_budget(&budget, source, (size_t)pages * page_size, "physical memory");
+    lower_budget(&budget, source, cgroup_memory_limit(), "cgroup");
+    lower_budget(&budget, source, rlimit_bytes(RLIMIT_AS), "RLIMIT_AS");
+    lower_budget(&budget, source, rlimit_bytes(RLIMIT_DATA), "RLIMIT_DATA");
+
+    return budget > 0 ? budget : BATCH_BUDGET_FALLBACK;
+}
+
+// BATCH SIZER INIT
+// Half the budget goes to the batches, the rest is left for everything
+// else in the process. Each batch's share is split between the line bytes
+// (the arena can hold up to twice what it was asked for, and MPI packs a
+// copy) and the per-line arrays.
+void batch_sizer_init(batch_sizer *sizer, size_t budget, int sharers, int depth, long fixed_lines)
+{
+    memset(sizer, 0, sizeof(*sizer));
+
+    if (budget == 0)
+        budget = memory_budget_detect(&sizer->source) / (sharers > 0 ? sharers : 1);
+    else
+        sizer->source = "--mem-budget";
+    sizer->budget = budget;
+
+    size_t per_batch = budget / 2 / (depth > 0 ? depth : 1);
+
+    sizer->max_bytes = per_batch / 4;
+    if (sizer->max_bytes < BATCH_MIN_BYTES)
+        sizer->max_bytes = BATCH_MIN_BYTES;
+    if (sizer->max_bytes > UINT32_MAX)
+        sizer->max_bytes = UINT32_MAX;
+
+    if (fixed_lines > 0)
+    {
+        sizer->max_lines = fixed_lines;
+    }
+    else
+    {
+        sizer->adaptive = 1;
+        sizer->max_lines = per_batch / 2 / BATCH_LINE_OVERHEAD;
+        if (sizer->max_lines > BATCH_MAX_LINES)
+            sizer->max_lines = BATCH_MAX_LINES;
+        if (sizer->max_lines < VALUES_PER_CACHE_LINE)
+            sizer->max_lines = VALUES_PER_CACHE_LINE;
+    }
+
+    sizer->target_bytes = BATCH_INITIAL_BYTES < sizer->max_bytes ? BATCH_INITIAL_BYTES : sizer->max_bytes;
+    if (!sizer->adaptive)
+        sizer->target_bytes = sizer->max_bytes;
+    sizer->smallest = sizer->target_bytes;
+    sizer->largest = sizer->target_bytes;
+}
+
+// BATCH SIZER NEXT
+// The batch being refilled went around the pipeline depth batches ago, so
+// its times are for an older target. Scaling them to the current target
+// keeps a few stale batches in a row from moving it too far.
+long batch_sizer_next(batch_sizer *sizer, const line_batch *batch)
+{
+    if (!sizer->adaptive)
+        return sizer->max_lines;
+
+    if (batch->lines > 0)
+    {
+        size_t bytes = batch->line_offsets[batch->lines];
+        double stage = batch->read_time > batch->compute_time ? batch->read_time : batch->compute_time;
+
+        // Time a batch of target_bytes would take at the rate this one ran
+        size_t target = sizer->target_bytes;
+        double projected = bytes > 0 ? stage * target / bytes : 0;
+
+        if (projected < BATCH_TIME_MIN && target < sizer->max_bytes)
+            target = target * 2 < sizer->max_bytes ? target * 2 : sizer->max_bytes;
+        else if (projected > BATCH_TIME_MAX && target > BATCH_MIN_BYTES)
+            target = target / 2 > BATCH_MIN_BYTES ? target / 2 : BATCH_MIN_BYTES;
+
+        if (target != sizer->target_bytes)
+        {
+            sizer->target_bytes = target;
+            sizer->resizes++;
+            if (target < sizer->smallest)
+                sizer->smallest = target;
+            if (target > sizer->largest)
+                sizer->largest = target;
+        }
+    }
+
+    return sizer->max_lines;
+}
+
+// BATCH SIZER REPORT
+void batch_sizer_report(FILE *fp, const batch_sizer *sizer)
+{
+    fprintf(fp, "\nBudget: %zu bytes (%s) Batch bytes: %zu max", sizer->budget, sizer->source, sizer->max_bytes);
+    if (sizer->adaptive)
+        fprintf(fp, ", target %zu..%zu, last %zu, %d resizes, %ld lines max", sizer->smallest, sizer->largest,
+                sizer->target_bytes, sizer->resizes, sizer->max_lines);
+    else
+        fprintf(fp, ", fixed %ld lines", sizer->max_lines);
+}
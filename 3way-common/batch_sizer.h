@@ -0,0 +1,60 @@
+#ifndef BATCH_SIZER_H
+#define BATCH_SIZER_H
+
+#include <stdio.h>
+
+#include "batch.h"
+
+// BATCH SIZER
+// Picks how many lines go into each batch from a memory budget instead of
+// a fixed 1000. Short lines get big batches, so the per-batch barriers and
+// MPI collectives are paid less often, and long lines get small ones, so a
+// batch of huge lines cannot push the job past its Slurm memory limit.
+//
+// The budget (--mem-budget, or the cgroup / rlimit limit of the job) is
+// split between the batches in flight. Within that the target size of a
+// batch starts at BATCH_INITIAL_BYTES and adapts while the run goes: the
+// slower of the read and compute stages is timed on every batch and scaled
+// to the target size, and the target doubles while that comes out under
+// BATCH_TIME_MIN and halves while it is over BATCH_TIME_MAX.
+// With --batch=N every batch is N lines instead, as before.
+
+#define BATCH_INITIAL_BYTES (1 << 20) // First target, the arena's first allocation
+#define BATCH_MIN_BYTES (64 << 10)    // Targets never shrink below this
+#define BATCH_TIME_MIN 0.001          // Seconds, shorter batches are dominated by barriers and collectives
+#define BATCH_TIME_MAX 0.010          // Seconds, longer batches fall out of cache between read and compute
+#define BATCH_MAX_LINES (1L << 22)    // Line capacity cap, the per-line arrays are allocated up front
+#define BATCH_BUDGET_FALLBACK (1UL << 30) // Slurm's default --mem-per-cpu when nothing limits the process
+
+typedef struct
+{
+    size_t budget;       // Bytes this process may use
+    const char *source;  // Where the budget came from
+    int adaptive;        // 0 with --batch, every batch is max_lines lines
+    size_t max_bytes;    // Most line bytes one batch may hold
+    long max_lines;      // Line capacity of every batch
+    size_t target_bytes; // Line bytes the next batch stops at (max_bytes with --batch)
+    size_t smallest, largest; // Range the target moved in
+    int resizes;         // Times the target changed
+} batch_sizer;
+
+// Memory this process may use: the lowest of the cgroup memory limit (v1
+// or v2, any parent cgroup included), RLIMIT_AS, RLIMIT_DATA and physical
+// memory. *source names the one that won. Falls back to BATCH_BUDGET_FALLBACK.
+size_t memory_budget_detect(const char **source);
+
+// Size batches for depth batches in flight. budget 0 means detect it and
+// split it between sharers processes (the MPI ranks on one node share the
+// job's cgroup). fixed_lines > 0 turns adaptation off (--batch=N).
+void batch_sizer_init(batch_sizer *sizer, size_t budget, int sharers, int depth, long fixed_lines);
+
+// Lines to read into batch next. The reader stage calls it before it
+// refills batch and stops the batch at that many lines or once it holds
+// sizer->target_bytes. The batch still has the lines and stage times of its
+// last fill, which the target learns from. Only the reader thread touches the sizer.
+long batch_sizer_next(batch_sizer *sizer, const line_batch *batch);
+
+// Write the budget and how the batch size moved to the times file
+void batch_sizer_report(FILE *fp, const batch_sizer *sizer);
+
+#endif
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+// Seconds on the monotonic clock
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+// Read the checkpoint at ck->path. Returns 1 when there is one for the
+// dump ck describes, 0 when there is none, -1 with errno set otherwise.
+static int checkpoint_load(run_checkpoint *ck)
+{
+    char magic[16];
+    long long size, sec, nsec, first, next, output;
+    unsigned long long offset;
+
+    FILE *fp = fopen(ck->path, "r");
+    if (fp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    int fields = fscanf(fp, "%15s %lld %lld %lld %lld %lld %llu %lld", magic, &size, &sec, &nsec, &first, &next,
+                        &offset, &output);
+    fclose(fp);
+
+    if (fields != 8 || strcmp(magic, CHECKPOINT_MAGIC) != 0 || next < first || offset > (unsigned long long)size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size != ck->file_size || sec != ck->mtime_sec || nsec != ck->mtime_nsec)
+    {
+        errno = ESTALE;
+        return -1;
+    }
+
+    ck->first_line = first;
+    ck->next_line = next;
+    ck->next_offset = offset;
+    ck->output_offset = output;
+    return 1;
+}
+
+// Cut output_fd back to the length it had at the checkpoint. Only a
+// regular file can be cut; a pipe or a terminal is left alone.
+static int rewind_output(run_checkpoint *ck, int output_fd)
+{
+    struct stat st;
+
+    if (ck->output_offset < 0 || output_fd < 0 || fstat(output_fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    if (st.st_size < ck->output_offset)
+    {
+        fprintf(stderr, "Warning: stdout holds less than the checkpoint's %lld bytes, append to the output "
+                        "of the first run with >>\n",
+                (long long)ck->output_offset);
+        ck->output_offset = -1;
+        return 0;
+    }
+
+    if (ftruncate(output_fd, ck->output_offset) != 0 || lseek(output_fd, ck->output_offset, SEEK_SET) < 0)
+        return -1;
+    return 0;
+}
+
+// RUN START
+int run_start(run_config *config, run_checkpoint *ck, line_index *index, int output_fd, uint64_t *offset)
+{
+    struct stat st;
+
+    memset(ck, 0, sizeof(*ck));
+    memset(index, 0, sizeof(*index));
+    ck->path = config->checkpoint_path;
+    ck->output_offset = -1;
+    *offset = 0;
+
+    if (ck->path == NULL && config->start == 0)
+        return 0;
+
+    if (stat(config->input_path, &st) != 0)
+        return -1;
+    ck->file_size = st.st_size;
+    ck->mtime_sec = st.st_mtim.tv_sec;
+    ck->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (config->resume)
+    {
+        int found = checkpoint_load(ck);
+        if (found < 0)
+            return -1;
+        if (found)
+        {
+            // --lines counts from the line the first run started at
+            if (config->lines != LONG_MAX)
+            {
+                long done = ck->next_line - ck->first_line;
+                config->lines = config->lines > done ? config->lines - done : 0;
+            }
+            config->start = ck->next_line;
+            ck->start_line = ck->next_line;
+            ck->resumed = 1;
+            *offset = ck->next_offset;
+            return rewind_output(ck, output_fd);
+        }
+    }
+
+    ck->first_line = config->start;
+    ck->start_line = config->start;
+    ck->next_line = config->start;
+    if (config->start == 0)
+        return 0;
+
+    if (line_index_open(index, config->input_path, config->index_path, config->threads) != 0)
+        return -1;
+
+    int fd = open(config->input_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int status = line_index_offset(index, fd, config->start, offset);
+    close(fd);
+
+    ck->next_offset = *offset;
+    return status;
+}
+
+// CHECKPOINT CONTINUES OUTPUT
+int checkpoint_continues_output(const run_checkpoint *ck)
+{
+    return ck->resumed && ck->output_offset > 0;
+}
+
+// Replace the checkpoint file with the current position
+static int write_checkpoint(run_checkpoint *ck)
+{
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", ck->path) >= (int)sizeof(temp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *fp = fopen(temp, "w");
+    if (fp == NULL)
+        return -1;
+
+    fprintf(fp, "%s %lld %lld %lld %ld %ld %llu %lld\n", CHECKPOINT_MAGIC, (long long)ck->file_size,
+            (long long)ck->mtime_sec, (long long)ck->mtime_nsec, ck->first_line, ck->next_line,
+            (unsigned long long)ck->next_offset, (long long)ck->output_offset);
+    if (fclose(fp) != 0 || rename(temp, ck->path) != 0)
+    {
+        unlink(temp);
+        return -1;
+    }
+
+    ck->last_save = now();
+    ck->saves++;
+    return 0;
+}
+
+// CHECKPOINT SAVE
+int checkpoint_save(run_checkpoint *ck, long next_line, uint64_t next_offset, int output_fd)
+{
+    if (ck->path == NULL)
+        return 0;
+
+    ck->next_line = next_line;
+    ck->next_offset = next_offset;
+    ck->output_offset = output_fd >= 0 ? lseek(output_fd, 0, SEEK_CUR) : -1;
+
+    if (now() - ck->last_save < CHECKPOINT_INTERVAL)
+        return 0;
+    return write_checkpoint(ck);
+}
+
+// CHECKPOINT FINISH
+int checkpoint_finish(run_checkpoint *ck)
+{
+    return ck->path != NULL ? write_checkpoint(ck) : 0;
+}
+
+// CHECKPOINT REPORT
+void checkpoint_report(FILE *fp, const run_checkpoint *ck)
+{
+    if (ck->path == NULL && ck->start_line == 0)
+        return;
+
+    fprintf(fp, "\nStart: line %ld", ck->start_line);
+    if (ck->resumed)
+        fprintf(fp, " (resumed, first run started at %ld)", ck->first_line);
+    if (ck->path != NULL)
+        fprintf(fp, " Checkpoint: %s, %ld written, last at line %ld", ck->path, ck->saves, ck->next_line);
+}
@@ -0,0 +1,70 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "line_index.h"
+
+// CHECKPOINT
+// Lets a killed run (killable.q preempts) carry on where it stopped. With
+// --checkpoint=file the writer stage records, at most once every
+// CHECKPOINT_INTERVAL seconds and at the end, the first line not written
+// yet, its byte offset in the dump and how long stdout was at that point.
+// A run started again with --resume seeks straight to that offset, cuts
+// stdout (appended to with >>) back to that length, so lines written after
+// the checkpoint are not there twice, and goes on from there:
+//
+//     ./pthread-exc t --checkpoint=ck dump.txt >> out.txt     (killed)
+//     ./pthread-exc t --checkpoint=ck --resume dump.txt >> out.txt
+//
+// --start=N without a checkpoint starts at line N through the line index.
+// The file is one text line, replaced with a rename so it is never half
+// written:
+//
+//     3WAYCKPT size mtime_sec mtime_nsec first_line next_line next_offset output_offset
+
+#define CHECKPOINT_MAGIC "3WAYCKPT"
+#define CHECKPOINT_INTERVAL 1.0 // Seconds between two checkpoint writes
+
+typedef struct
+{
+    const char *path;      // --checkpoint, NULL for none
+    int64_t file_size;     // Size and mtime of the dump the offsets are for
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    long first_line;       // First line of the run that started the checkpoint
+    long start_line;       // First line of this run
+    long next_line;        // First line not written yet
+    uint64_t next_offset;  // Its byte offset in the dump
+    int64_t output_offset; // stdout length before next_line, -1 when stdout cannot seek
+    double last_save;      // Monotonic time of the last write
+    long saves;
+    int resumed;           // This run carried on from the checkpoint
+} run_checkpoint;
+
+// RUN START
+// Where this run begins. With --resume and a checkpoint for this dump,
+// config->start and config->lines move on to the checkpoint's next line
+// and output_fd is cut back to its length then; otherwise line
+// config->start is found with the line index (built when needed, index is
+// left empty for line 0). *offset is the byte offset of the first line.
+// Returns 0, or -1 with errno set (ESTALE for a checkpoint of another dump).
+int run_start(run_config *config, run_checkpoint *ck, line_index *index, int output_fd, uint64_t *offset);
+
+// Whether stdout already holds the first run's output, headers included
+int checkpoint_continues_output(const run_checkpoint *ck);
+
+// Everything before next_line (at next_offset) is written to output_fd
+// (-1 when nothing is written). Writes the file when CHECKPOINT_INTERVAL
+// has passed since the last time. Returns 0, or -1 with errno set.
+int checkpoint_save(run_checkpoint *ck, long next_line, uint64_t next_offset, int output_fd);
+
+// Write the last position saved, at the end of the run
+int checkpoint_finish(run_checkpoint *ck);
+
+// Where the run started and how many checkpoints it wrote, for the times file
+void checkpoint_report(FILE *fp, const run_checkpoint *ck);
+
+#endif
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+
+#include "codepoint.h"
+
+// 16 bytes as one vector, SSE2 on x86-64 and NEON on ARM, as in line_stats.c
+typedef unsigned char byte_vector __attribute__((vector_size(16)));
+typedef signed char lane_mask __attribute__((vector_size(16)));
+typedef uint64_t word_vector __attribute__((vector_size(16)));
+
+// Decode the sequence at p, left bytes at most. Returns how many bytes it
+// took, with the code point in *cp, or -1 in *cp for an invalid sequence.
+static inline size_t decode(const unsigned char *p, size_t left, int *cp)
+{
+    unsigned lead = p[0];
+    unsigned low = 0x80, high = 0xbf;
+    size_t length;
+    int value;
+
+    if (lead < 0x80)
+    {
+        *cp = lead;
+        return 1;
+    }
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        length = 2;
+        value = lead & 0x1f;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        // E0 80-9F would be overlong, ED A0-BF a surrogate
+        length = 3;
+        value = lead & 0x0f;
+        low = lead == 0xe0 ? 0xa0 : 0x80;
+        high = lead == 0xed ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        // F0 80-8F would be overlong, F4 90-BF above U+10FFFF
+        length = 4;
+        value = lead & 0x07;
+        low = lead == 0xf0 ? 0x90 : 0x80;
+        high = lead == 0xf4 ? 0x8f : 0xbf;
+    }
+    else
+    {
+        *cp = -1;
+        return 1;
+    }
+
+    for (size_t k = 1; k < length; k++)
+    {
+        if (k >= left || p[k] < low || p[k] > high)
+        {
+            *cp = -1;
+            return k;
+        }
+        value = value << 6 | (p[k] & 0x3f);
+        low = 0x80;
+        high = 0xbf;
+    }
+
+    *cp = value;
+    return length;
+}
+
+// CODEPOINT SCAN SCALAR
+void codepoint_scan_scalar(const unsigned char *p, size_t len, int *out)
+{
+    size_t text = len > 0 && p[len - 1] == '\n' ? len - 1 : len;
+    int max = text < len ? '\n' : 0;
+    int invalid = 0;
+    int cp;
+
+    for (size_t i = 0; i < text;)
+    {
+        i += decode(p + i, text - i, &cp);
+        if (cp > max)
+            max = cp;
+        invalid += cp < 0;
+    }
+
+    out[0] = max;
+    out[1] = invalid;
+}
+
+// Non-zero if any byte of v is >= 0x80
+static inline uint64_t any_high(byte_vector v)
+{
+    word_vector word = (word_vector)v;
+
+    return (word[0] | word[1]) & 0x8080808080808080ull;
+}
+
+static inline byte_vector load(const unsigned char *p)
+{
+    byte_vector v;
+
+    memcpy(&v, p, 16);
+    return v;
+}
+
+// Lanes of v that are continuation bytes (10xxxxxx)
+#define CONTINUATION(v) ((lane_mask)(((v) & 0xc0) == 0x80))
+
+// Larger of a and b in every lane (vector ?: is C++ only)
+#define VECTOR_MAX(a, b) (((a) & ~(byte_vector)((b) > (a))) | ((b) & (byte_vector)((b) > (a))))
+
+// Lane by lane select, m is -1 or 0
+#define SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+// Check the 16 positions at p and keep the largest sequence of each lane.
+// Every lane that is not a continuation byte is a lead: it must not be
+// C0, C1 or F5-FF, the bytes its length asks for must be continuations
+// and the byte right after them must not be one, which leaves no
+// continuation unclaimed. Up to 4 bytes past the block are read for that.
+// Returns 0 if the block holds an invalid sequence, otherwise 1.
+static inline int decode_block(const unsigned char *p, byte_vector best[4])
+{
+    const lane_mask first = {-1};
+    byte_vector b0 = load(p), b1 = load(p + 1), b2 = load(p + 2), b3 = load(p + 3), b4 = load(p + 4);
+    lane_mask c0 = CONTINUATION(b0), c1 = CONTINUATION(b1), c2 = CONTINUATION(b2), c3 = CONTINUATION(b3),
+              c4 = CONTINUATION(b4);
+    // Lanes whose lead asks for at least 1, 2 and 3 continuations
+    lane_mask more1 = (lane_mask)(b0 >= 0xc0), more2 = (lane_mask)(b0 >= 0xe0), more3 = (lane_mask)(b0 >= 0xf0);
+    // Second bytes A0-BF are a must after E0 and surrogates after ED, 90-BF a must after F0 and too large after F4
+    lane_mask high_a0 = (lane_mask)((b1 & 0x20) != 0), high_90 = (lane_mask)((b1 & 0x30) != 0);
+
+    lane_mask error = (first & c0) | (~c0 & (c1 ^ more1)) | (more1 & (c2 ^ more2)) | (more2 & (c3 ^ more3)) |
+                      (more3 & c4);
+    error |= (lane_mask)((byte_vector)(b0 - 0xc0) < 2) | (lane_mask)(b0 >= 0xf5);
+    error |= ((lane_mask)(b0 == 0xe0) & ~high_a0) | ((lane_mask)(b0 == 0xed) & high_a0);
+    error |= ((lane_mask)(b0 == 0xf0) & ~high_90) | ((lane_mask)(b0 == 0xf4) & high_90);
+    if (any_high((byte_vector)error))
+        return 0;
+
+    // UTF-8 sorts like the code points it encodes, and the lead byte ranges
+    // of the four lengths do not overlap, so the max sequence byte by byte
+    // is the max code point. Each lane keeps the largest (lead, 2nd, 3rd,
+    // 4th byte) it has seen, the bytes past a sequence's length as 0;
+    // nothing is decoded until the end of the line.
+    byte_vector k0 = b0 & ~(byte_vector)c0;
+    byte_vector k1 = b1 & (byte_vector)more1;
+    byte_vector k2 = b2 & (byte_vector)more2;
+    byte_vector k3 = b3 & (byte_vector)more3;
+    lane_mask greater = (lane_mask)(k0 > best[0]) |
+                        ((lane_mask)(k0 == best[0]) &
+                         ((lane_mask)(k1 > best[1]) |
+                          ((lane_mask)(k1 == best[1]) &
+                           ((lane_mask)(k2 > best[2]) | ((lane_mask)(k2 == best[2]) & (lane_mask)(k3 > best[3]))))));
+
+    best[0] = SELECT((byte_vector)greater, k0, best[0]);
+    best[1] = SELECT((byte_vector)greater, k1, best[1]);
+    best[2] = SELECT((byte_vector)greater, k2, best[2]);
+    best[3] = SELECT((byte_vector)greater, k3, best[3]);
+    return 1;
+}
+
+// CODEPOINT SCAN
+// Pure ASCII runs go 32 bytes at a time with one test of the top bits and
+// a byte max, as cheap as the max_byte loop. A block with a byte >= 0x80
+// is validated and decoded 16 positions at a time by decode_block; only a
+// block with an invalid sequence in it, and the last bytes of the line,
+// go through the scalar decoder. Both always stop at a sequence start, so
+// the split never changes what is counted.
+void codepoint_scan(const unsigned char *p, size_t len, int *out)
+{
+    size_t text = len > 0 && p[len - 1] == '\n' ? len - 1 : len;
+    int max = text < len ? '\n' : 0;
+    int invalid = 0;
+    byte_vector vascii = {0};
+    byte_vector best[4] = {{0}, {0}, {0}, {0}};
+    int cp;
+    size_t i = 0;
+
+    while (i + 16 <= text)
+    {
+        byte_vector v = load(p + i);
+
+        if (!any_high(v))
+        {
+            vascii = VECTOR_MAX(vascii, v);
+            i += 16;
+
+            for (; i + 32 <= text; i += 32)
+            {
+                byte_vector a = load(p + i), b = load(p + i + 16);
+                if (any_high(a | b))
+                    break;
+                vascii = VECTOR_MAX(vascii, VECTOR_MAX(a, b));
+            }
+            continue;
+        }
+
+        if (i + 20 <= text && decode_block(p + i, best))
+        {
+            // The last lead may end past the block, its continuations were checked already
+            for (i += 16; (p[i] & 0xc0) == 0x80; i++)
+                ;
+            continue;
+        }
+
+        for (size_t stop = i + 16; i < stop;)
+        {
+            i += decode(p + i, text - i, &cp);
+            if (cp > max)
+                max = cp;
+            invalid += cp < 0;
+        }
+    }
+
+    while (i < text)
+    {
+        i += decode(p + i, text - i, &cp);
+        if (cp > max)
+            max = cp;
+        invalid += cp < 0;
+    }
+
+    // Largest sequence any lane kept, as one big-endian word, decoded once
+    uint32_t key = 0;
+    for (int lane = 0; lane < 16; lane++)
+    {
+        uint32_t lane_key = (uint32_t)best[0][lane] << 24 | best[1][lane] << 16 | best[2][lane] << 8 | best[3][lane];
+        key = lane_key > key ? lane_key : key;
+        max = vascii[lane] > max ? vascii[lane] : max;
+    }
+    if (key != 0)
+    {
+        unsigned char sequence[4] = {key >> 24, key >> 16, key >> 8, key};
+        decode(sequence, 4, &cp);
+        max = cp > max ? cp : max;
+    }
+
+    out[0] = max;
+    out[1] = invalid;
+}
@@ -0,0 +1,25 @@
+#ifndef CODEPOINT_H
+#define CODEPOINT_H
+
+#include <stddef.h>
+
+// CODEPOINT
+// Max Unicode code point of a line read as UTF-8, and how many invalid
+// sequences it has (--stats=codepoint). max_byte compares signed bytes, so
+// every byte of a multi-byte sequence is negative there and a line of
+// Cyrillic or CJK text reports its largest ASCII byte instead.
+//
+// An invalid sequence is counted the way a decoder writing U+FFFD would:
+// a byte that cannot start a sequence (a stray continuation, C0, C1,
+// F5-FF) counts one, a sequence cut short by a byte that does not fit
+// counts one for its valid start, and the byte that broke it is read again.
+// Overlong forms, surrogates and anything above U+10FFFF are invalid.
+// Like max, the newline is included, so a line with one has at least 10.
+
+// out[0] = max code point, out[1] = invalid sequences of the len bytes at p
+void codepoint_scan(const unsigned char *p, size_t len, int *out);
+
+// Sequence by sequence decoder, the reference the vector version must match
+void codepoint_scan_scalar(const unsigned char *p, size_t len, int *out);
+
+#endif
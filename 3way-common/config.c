@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "line_stats.h"
+#include "pipeline.h"
+#include "stream_input.h"
+
+// Positive number from text, -1 if it is not one
+static long parse_count(const char *text)
+{
+    char *end;
+    long n = strtol(text, &end, 10);
+
+    return (end == text || *end != '\0' || n <= 0) ? -1 : n;
+}
+
+// Non-negative number from text (a line number, counted from 0), -1 if it is not one
+static long parse_index(const char *text)
+{
+    char *end;
+    long n = strtol(text, &end, 10);
+
+    return (end == text || *end != '\0' || n < 0) ? -1 : n;
+}
+
+// Byte count with an optional K, M or G suffix, 0 if it is not one
+static size_t parse_size(const char *text)
+{
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    int shift = 0;
+
+    if (end == text || *text == '-')
+        return 0;
+
+    switch (*end)
+    {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+
+    if (*end != '\0' || n > (SIZE_MAX >> shift))
+        return 0;
+    return (size_t)n << shift;
+}
+
+// Positive number from an environment variable, 0 if unset or not a number
+static int env_count(const char *name)
+{
+    const char *value = getenv(name);
+    if (value == NULL)
+        return 0;
+
+    long n = parse_count(value);
+    return (n > 0 && n <= INT_MAX) ? (int)n : 0;
+}
+
+// CONFIG DEFAULT THREADS
+int config_default_threads(void)
+{
+    int threads = env_count("OMP_NUM_THREADS");
+    if (threads == 0)
+        threads = env_count("NUM_CORES");
+
+    if (threads == 0)
+    {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            threads = CPU_COUNT(&set);
+    }
+
+    return threads > 0 ? threads : 1;
+}
+
+// CONFIG INIT
+void config_init(run_config *config, long default_lines)
+{
+    memset(config, 0, sizeof(*config));
+    config->input_path = DEFAULT_INPUT_PATH;
+    config->lines = default_lines;
+    config->threads = config_default_threads();
+    config->depth = DEFAULT_PIPELINE_DEPTH;
+    config->output = OUTPUT_TEXT;
+    config->schedule = DEFAULT_SCHEDULE;
+    config->queue_depth = DEFAULT_QUEUE_DEPTH;
+    config->block_size = STREAM_BLOCK_SIZE;
+}
+
+static void usage(const char *program, int options)
+{
+    fprintf(stderr, "Usage: %s <times_file> [--lines=N|all] [--batch=N] [--mem-budget=N[K|M|G]]%s [--output=text|binary|none] [--metrics=file] [--trace=file] [--histogram=file] [--stats=max,min,length,non_ascii,classes,codepoint|all] [--start=N] [--index=file] [--checkpoint=file] [--resume] [--cache=file] [--mmap] [--uring] [--queue-depth=N] [--block-size=N[K|M]] [--depth=N]%s%s%s [input_file|-]\n",
+            program, (options & CONFIG_THREADS) ? " [--threads=N]" : "",
+            (options & CONFIG_SCHEDULE) ? " [--schedule=static|bytes|dynamic]" : "",
+            (options & CONFIG_PIN) ? " [--pin=none|compact|spread]" : "",
+            (options & CONFIG_MPI) ? " [--gather=values|text] [--read=root|parallel]" : "");
+}
+
+static int bad_value(const char *arg, const char *program, int options)
+{
+    fprintf(stderr, "Bad value in %s\n", arg);
+    usage(program, options);
+    return -1;
+}
+
+// Value of --name=value if arg is that option, NULL otherwise
+static const char *option_value(const char *arg, const char *name)
+{
+    size_t length = strlen(name);
+
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+
+    return NULL;
+}
+
+// CONFIG PARSE
+int config_parse(run_config *config, int argc, char *args[], int options)
+{
+    const char *value;
+    long n;
+    int lines_given = 0;
+
+    if (argc < 2)
+    {
+        usage(args[0], options);
+        return -1;
+    }
+
+    config->times_path = args[1];
+
+    for (int i = 2; i < argc; i++)
+    {
+        const char *arg = args[i];
+
+        if (strcmp(arg, "--mmap") == 0)
+            config->use_mmap = 1;
+        else if (strcmp(arg, "--uring") == 0)
+            config->use_uring = 1;
+        else if (strcmp(arg, "--resume") == 0)
+            config->resume = 1;
+        else if ((value = option_value(arg, "--lines")) != NULL)
+        {
+            n = strcmp(value, "all") == 0 ? LONG_MAX : parse_count(value);
+            if (n < 0)
+                return bad_value(arg, args[0], options);
+            config->lines = n;
+            lines_given = 1;
+        }
+        else if ((value = option_value(arg, "--start")) != NULL)
+        {
+            if ((config->start = parse_index(value)) < 0)
+                return bad_value(arg, args[0], options);
+        }
+        else if ((value = option_value(arg, "--index")) != NULL)
+            config->index_path = value;
+        else if ((value = option_value(arg, "--checkpoint")) != NULL)
+            config->checkpoint_path = value;
+        else if ((value = option_value(arg, "--cache")) != NULL)
+            config->cache_path = value;
+        else if ((value = option_value(arg, "--batch")) != NULL)
+        {
+            // Offsets inside a batch are 32 bits, keep the line count well inside that too
+            if ((n = parse_count(value)) < 0 || n > INT_MAX)
+                return bad_value(arg, args[0], options);
+            config->batch_lines = n;
+        }
+        else if ((value = option_value(arg, "--metrics")) != NULL)
+            config->metrics_path = value;
+        else if ((value = option_value(arg, "--trace")) != NULL)
+            config->trace_path = value;
+        else if ((value = option_value(arg, "--histogram")) != NULL)
+            config->histogram_path = value;
+        else if ((value = option_value(arg, "--stats")) != NULL)
+        {
+            if (line_stats_parse(value, &config->stats) != 0)
+                return bad_value(arg, args[0], options);
+        }
+        else if ((value = option_value(arg, "--mem-budget")) != NULL)
+        {
+            if ((config->mem_budget = parse_size(value)) == 0)
+                return bad_value(arg, args[0], options);
+        }
+        else if ((options & CONFIG_THREADS) && (value = option_value(arg, "--threads")) != NULL)
+        {
+            if ((n = parse_count(value)) < 0 || n > 4096)
+                return bad_value(arg, args[0], options);
+            config->threads = n;
+        }
+        else if ((value = option_value(arg, "--queue-depth")) != NULL)
+        {
+            if ((n = parse_count(value)) < 0 || n > 4096)
+                return bad_value(arg, args[0], options);
+            config->queue_depth = n;
+        }
+        else if ((value = option_value(arg, "--block-size")) != NULL)
+        {
+            // Whole pages, and a read length io_uring and read() take in one go
+            size_t size = parse_size(value);
+            if (size < 4096 || size > (1 << 30))
+                return bad_value(arg, args[0], options);
+            config->block_size = size;
+        }
+        else if ((value = option_value(arg, "--depth")) != NULL)
+        {
+            if ((n = parse_count(value)) < 0 || n > 1024)
+                return bad_value(arg, args[0], options);
+            config->depth = n;
+        }
+        else if ((value = option_value(arg, "--output")) != NULL)
+        {
+            if (strcmp(value, "text") == 0)
+                config->output = OUTPUT_TEXT;
+            else if (strcmp(value, "binary") == 0)
+                config->output = OUTPUT_BINARY;
+            else if (strcmp(value, "none") == 0)
+                config->output = OUTPUT_NONE;
+            else
+                return bad_value(arg, args[0], options);
+        }
+        else if ((options & CONFIG_SCHEDULE) && (value = option_value(arg, "--schedule")) != NULL)
+        {
+            if (schedule_parse(value, &config->schedule) != 0)
+                return bad_value(arg, args[0], options);
+        }
+        else if ((options & CONFIG_PIN) && (value = option_value(arg, "--pin")) != NULL)
+        {
+            if (pin_parse(value, &config->pin) != 0)
+                return bad_value(arg, args[0], options);
+        }
+        else if ((options & CONFIG_MPI) && (value = option_value(arg, "--gather")) != NULL)
+        {
+            if (strcmp(value, "text") == 0)
+                config->gather_text = 1;
+            else if (strcmp(value, "values") == 0)
+                config->gather_text = 0;
+            else
+                return bad_value(arg, args[0], options);
+        }
+        else if ((options & CONFIG_MPI) && (value = option_value(arg, "--read")) != NULL)
+        {
+            if (strcmp(value, "parallel") == 0)
+                config->read_parallel = 1;
+            else if (strcmp(value, "root") == 0)
+                config->read_parallel = 0;
+            else
+                return bad_value(arg, args[0], options);
+        }
+        else if (strncmp(arg, "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown option %s\n", arg);
+            usage(args[0], options);
+            return -1;
+        }
+        else
+            config->input_path = arg;
+    }
+
+    if (config->stats != 0 && config->histogram_path != NULL)
+    {
+        fprintf(stderr, "--stats and --histogram are different kernels, pick one\n");
+        usage(args[0], options);
+        return -1;
+    }
+
+    if (config->resume && config->checkpoint_path == NULL)
+    {
+        fprintf(stderr, "--resume carries on from a --checkpoint file, give one\n");
+        usage(args[0], options);
+        return -1;
+    }
+
+    // Starting part way needs a file to seek in, and every rank of --read=parallel starts at its own byte range
+    if ((config->start > 0 || config->checkpoint_path != NULL) &&
+        (strcmp(config->input_path, "-") == 0 || config->read_parallel))
+    {
+        fprintf(stderr, "--start and --checkpoint need an input file and --read=root\n");
+        usage(args[0], options);
+        return -1;
+    }
+
+    // The cache holds every line's values from line 0 on, the writer records them from whole batches of the dump
+    if (config->cache_path != NULL &&
+        (config->start > 0 || config->checkpoint_path != NULL || config->histogram_path != NULL ||
+         config->gather_text || config->read_parallel || strcmp(config->input_path, "-") == 0))
+    {
+        fprintf(stderr, "--cache needs an input file, --read=root and --gather=values, "
+                        "and does not go with --start, --checkpoint or --histogram\n");
+        usage(args[0], options);
+        return -1;
+    }
+
+    if (config->use_mmap && config->use_uring)
+    {
+        fprintf(stderr, "--mmap and --uring are two ways to read the file, pick one\n");
+        usage(args[0], options);
+        return -1;
+    }
+
+    // A pipe has no size to map or split, and the point of piping a dump in is to read all of it
+    if (strcmp(config->input_path, "-") == 0)
+    {
+        config->use_stream = 1;
+        config->use_mmap = 0;
+        config->use_uring = 0;
+        config->read_parallel = 0;
+        if (!lines_given)
+            config->lines = LONG_MAX;
+    }
+
+    return 0;
+}
+
+// CONFIG REPORT
+void config_report(FILE *fp, const run_config *config)
+{
+    fprintf(fp, "\nInput: %s Lines: ", config->input_path);
+    if (config->lines == LONG_MAX)
+        fprintf(fp, "all");
+    else
+        fprintf(fp, "%ld", config->lines);
+    if (config->batch_lines > 0)
+        fprintf(fp, " Batch: %ld", config->batch_lines);
+    else
+        fprintf(fp, " Batch: adaptive");
+    fprintf(fp, " Threads: %d Depth: %d Mode: %s", config->threads, config->depth,
+            config->use_mmap ? "mmap" : config->use_stream ? "stream" : config->use_uring ? "uring" : "getline");
+    if (config->histogram_path != NULL)
+        fprintf(fp, " Histogram: %s", config->histogram_path);
+    if (config->stats != 0)
+    {
+        char schema[STATS_SCHEMA_MAX];
+        line_stats_schema(schema, config->stats);
+        fprintf(fp, " Stats: %s", schema + strlen("line: "));
+    }
+    if (config->output == OUTPUT_BINARY)
+        fprintf(fp, " Output: binary");
+}
@@ -0,0 +1,100 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+
+#include "schedule.h"
+#include "topology.h"
+
+// RUN CONFIG
+// Everything that used to need an edit and a rebuild (LINES_TO_READ,
+// NUM_THREADS, the batch size, the dump's path) is read from the command
+// line instead, so one binary per backend covers every data size and core
+// count:
+//
+//     <exc> <times_file> [options] [input_file]
+//
+// input_file "-" streams standard input (stream_input.h) and reads all of
+// it unless --lines says otherwise; --mmap, --uring and --read=parallel
+// need a real file and are ignored for it.
+//
+//     --lines=N|all        lines to read from the input
+//     --batch=N            lines per batch (default: sized from the memory budget)
+//     --mem-budget=N[K|M|G] memory for this process (default: cgroup / rlimit limit)
+//     --threads=N          worker threads (pthread, OpenMP)
+//     --output=text|binary|none  write the results as text or records (results_file.h),
+//                          or only compute them
+//     --metrics=file       per-phase times and counters as JSON (see trace.h)
+//     --trace=file         Chrome trace timeline of every phase
+//     --histogram=file     count letters per line and every byte value (histogram.h)
+//     --stats=max,min,...  several results per line in one pass (line_stats.h)
+//     --start=N            start at line N, through a sidecar line index (line_index.h)
+//     --index=file         where that index is kept (default: input_file.idx)
+//     --checkpoint=file    record progress there; --resume carries on from it (checkpoint.h)
+//     --cache=file         reuse the results of the unchanged start of the dump (result_cache.h)
+//     --uring              read the file with queue-depth reads in flight (stream_input.h)
+//     --queue-depth=N      reads in flight with --uring (default 16)
+//     --block-size=N[K|M]  bytes per read with --uring and standard input (default 1M)
+//     --mmap  --depth=N  --schedule=...  --pin=...  --gather=...  --read=...
+
+#define DEFAULT_INPUT_PATH "/homes/dan/625/wiki_dump.txt"
+
+// Options a backend takes besides the common ones
+#define CONFIG_THREADS 1  // --threads
+#define CONFIG_SCHEDULE 2 // --schedule
+#define CONFIG_MPI 4      // --gather and --read
+#define CONFIG_PIN 8      // --pin
+
+typedef enum
+{
+    OUTPUT_TEXT,   // "line: value" lines on stdout
+    OUTPUT_BINARY, // Fixed-size records on stdout (results_file.h)
+    OUTPUT_NONE    // Results are computed and rendered but not written
+} output_mode;
+
+typedef struct
+{
+    const char *times_path; // First argument, where the timing lines go
+    const char *input_path; // Last plain argument, the wiki dump by default
+    const char *metrics_path; // --metrics, NULL for none
+    const char *trace_path;   // --trace, NULL for none
+    const char *histogram_path; // --histogram, NULL for the max ASCII kernel
+    unsigned stats;         // --stats STAT_* flags, 0 for the max ASCII kernel
+    long lines;             // Most lines to read (LONG_MAX for all of them)
+    long start;             // First line to read, found with the line index (line_index.h)
+    const char *index_path; // --index, NULL for the input path + ".idx"
+    const char *checkpoint_path; // --checkpoint, NULL for none (checkpoint.h)
+    int resume;             // --resume: carry on from the checkpoint
+    const char *cache_path; // --cache, NULL for none (result_cache.h)
+    long batch_lines;       // Lines per batch, 0 to size batches from mem_budget
+    size_t mem_budget;      // Bytes this process may use, 0 to detect it
+    int threads;            // Worker threads per process
+    int depth;              // Batches in flight in the pipeline
+    int use_mmap;           // Scan the input in place instead of copying lines with getline
+    int use_stream;         // Input is "-", standard input read in blocks
+    int use_uring;          // --uring: the file read in blocks with many reads in flight
+    int queue_depth;        // Reads in flight with --uring
+    size_t block_size;      // Bytes per block for --uring and standard input
+    output_mode output;
+    schedule_kind schedule; // pthread, OpenMP
+    pin_mode pin;           // pthread, OpenMP: where the workers run (topology.h)
+    int gather_text;        // MPI: ranks send formatted text instead of values
+    int read_parallel;      // MPI: every rank reads its own byte range
+} run_config;
+
+// Defaults: default_lines lines (the backend's old LINES_TO_READ) and
+// config_default_threads threads
+void config_init(run_config *config, long default_lines);
+
+// Fill config from the command line. options is a mask of CONFIG_* for the
+// backend. Returns 0, or -1 after printing the problem and the usage to stderr.
+int config_parse(run_config *config, int argc, char *args[], int options);
+
+// Threads this process should use: OMP_NUM_THREADS, then NUM_CORES (set by
+// the Slurm scripts), then the CPUs in this process's affinity mask
+int config_default_threads(void);
+
+// Write the settings of the run to the times file
+void config_report(FILE *fp, const run_config *config);
+
+#endif
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "histogram.h"
+
+// 16 bytes as one vector, SSE2 on x86-64 and NEON on ARM with no intrinsics
+typedef unsigned char byte_vector __attribute__((vector_size(16)));
+
+// HISTOGRAM ALLOC
+byte_histogram *histogram_alloc(int count)
+{
+    size_t size = count * sizeof(byte_histogram);
+
+    // aligned_alloc wants a multiple of the alignment, the struct already is one
+    byte_histogram *hists = aligned_alloc(CACHE_LINE, size);
+    if (hists != NULL)
+        memset(hists, 0, size);
+    return hists;
+}
+
+// Letters in the len bytes at p. A byte is a letter when it is one of
+// 'a'..'z' after OR-ing in the lowercase bit, which is one unsigned
+// compare per byte. The compare gives 0xff (-1) for a letter, so
+// subtracting it counts up; byte lanes are summed before they can pass 255.
+static int count_letters(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+    int letters = 0;
+
+    while (i + 16 <= len)
+    {
+        byte_vector acc = {0};
+        size_t stop = i + 16 * 255 < len ? i + 16 * 255 : len;
+
+        for (; i + 16 <= stop; i += 16)
+        {
+            byte_vector v;
+            memcpy(&v, p + i, 16);
+            acc -= (byte_vector)(((v | 0x20) - (unsigned char)'a') < 26);
+        }
+
+        for (int lane = 0; lane < 16; lane++)
+            letters += acc[lane];
+    }
+
+    for (; i < len; i++)
+        letters += (unsigned char)((p[i] | 0x20) - 'a') < 26;
+
+    return letters;
+}
+
+// HISTOGRAM LINES
+void histogram_lines(byte_histogram *h, int *values, const char *bytes, const uint32_t *line_offsets, long start,
+                     long end)
+{
+    for (long line = start; line < end; line++)
+    {
+        const unsigned char *p = (const unsigned char *)bytes + line_offsets[line];
+        size_t len = line_offsets[line + 1] - line_offsets[line];
+        size_t i = 0;
+
+        for (; i + 4 <= len; i += 4)
+        {
+            h->sub[0][p[i]]++;
+            h->sub[1][p[i + 1]]++;
+            h->sub[2][p[i + 2]]++;
+            h->sub[3][p[i + 3]]++;
+        }
+        for (; i < len; i++)
+            h->sub[0][p[i]]++;
+
+        values[line] = count_letters(p, len);
+    }
+}
+
+// HISTOGRAM FOLD
+void histogram_fold(byte_histogram *h)
+{
+    for (int s = 0; s < HISTOGRAM_SUBS; s++)
+    {
+        for (int b = 0; b < HISTOGRAM_BINS; b++)
+            h->total[b] += h->sub[s][b];
+    }
+    memset(h->sub, 0, sizeof(h->sub));
+}
+
+// HISTOGRAM MERGE
+// Level by level, histogram i takes in i + stride. The pairs of a level
+// are independent, so the sums never run through one long chain.
+void histogram_merge(byte_histogram *hists, int count)
+{
+    for (int stride = 1; stride < count; stride *= 2)
+    {
+        for (int i = 0; i + stride < count; i += 2 * stride)
+        {
+            for (int b = 0; b < HISTOGRAM_BINS; b++)
+                hists[i].total[b] += hists[i + stride].total[b];
+        }
+    }
+}
+
+// HISTOGRAM WRITE
+int histogram_write(const char *path, const uint64_t *total)
+{
+    uint64_t letters = 0, bytes = 0;
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    // Upper and lower case together, like the 26 counters of countChar
+    for (int c = 0; c < 26; c++)
+    {
+        uint64_t count = total['a' + c] + total['A' + c];
+        letters += count;
+        fprintf(fp, " %c %lu\n", 'a' + c, count);
+    }
+    fprintf(fp, "\nTotal characters:  %lu\n", letters);
+
+    for (int b = 0; b < HISTOGRAM_BINS; b++)
+        bytes += total[b];
+    fprintf(fp, "\nTotal bytes:  %lu\n", bytes);
+
+    for (int b = 0; b < HISTOGRAM_BINS; b++)
+    {
+        if (total[b] != 0)
+            fprintf(fp, "%d %lu\n", b, total[b]);
+    }
+
+    return fclose(fp);
+}
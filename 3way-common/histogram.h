@@ -0,0 +1,54 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// HISTOGRAM
+// CPU version of the countChar kernel in cuda3Way.cu, run over the same
+// batches as max_byte (--histogram=file). The CUDA kernel widens every
+// character to an int and has every thread increment shared counters;
+// here the bytes are read as they are and every thread counts into its
+// own histogram, so nothing is shared until the end of the run.
+//
+// Each thread keeps HISTOGRAM_SUBS sub-histograms of all 256 byte values
+// and consecutive bytes go to different ones: a run of the same letter
+// then increments different counters instead of waiting on the store to
+// the one before. The 32-bit sub-histograms are folded into the 64-bit
+// totals once per batch, and at the end the threads' totals (and the
+// ranks', with MPI_Reduce) are summed pairwise in a tree.
+//
+// The per-line result written to stdout is the number of letters (a-z,
+// A-Z) in the line, counted 16 bytes at a time with vector compares. The
+// global counts go to the histogram file.
+
+#define HISTOGRAM_BINS 256
+#define HISTOGRAM_SUBS 4 // Sub-histograms per thread
+
+// One thread's counts, on its own cache lines
+typedef struct
+{
+    uint32_t sub[HISTOGRAM_SUBS][HISTOGRAM_BINS]; // Counts since the last fold
+    uint64_t total[HISTOGRAM_BINS];               // Counts of every batch folded so far
+} byte_histogram;
+
+// count zeroed histograms, cache line aligned. NULL when out of memory.
+byte_histogram *histogram_alloc(int count);
+
+// Count the bytes of lines [start, end) into h and set values[i] to the
+// letters in line i. Line i is bytes + line_offsets[i] up to line_offsets[i + 1].
+void histogram_lines(byte_histogram *h, int *values, const char *bytes, const uint32_t *line_offsets, long start,
+                     long end);
+
+// Add the sub-histograms to total and clear them. Call after every batch
+// (a batch is under 4 GiB, so no 32-bit counter can wrap before).
+void histogram_fold(byte_histogram *h);
+
+// Tree reduction: hists[0].total becomes the sum of the totals of all count
+void histogram_merge(byte_histogram *hists, int count);
+
+// Write the letter counts in the format of cuda3Way.cu's print_results,
+// then every byte value that was seen. Returns 0, or -1 with errno set.
+int histogram_write(const char *path, const uint64_t *total);
+
+#endif
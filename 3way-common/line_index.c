@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "line_index.h"
+
+// One thread's slice of the dump while the index is built
+typedef struct
+{
+    const char *data;
+    size_t size;           // Of the whole dump
+    size_t start, end;     // Slice [start, end)
+    uint64_t newlines;     // Counted in the first pass
+    uint64_t first_line;   // Lines that start before the slice, set between the passes
+    uint64_t stride;
+    uint64_t *offsets;     // Written in the second pass
+    int pass;
+} index_slice;
+
+// Seconds on the monotonic clock
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+// INDEX WORKER
+// Pass 1 counts the newlines of the slice. Pass 2 walks them again knowing
+// the number of the line each one ends, and records the offset of the
+// line after it whenever that line is a multiple of the stride.
+static void *index_worker(void *arg)
+{
+    index_slice *s = arg;
+    const char *p = s->data + s->start;
+    const char *end = s->data + s->end;
+    uint64_t line = s->first_line;
+
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL)
+            break;
+
+        if (s->pass == 1)
+            s->newlines++;
+        else if (++line % s->stride == 0 && (size_t)(nl + 1 - s->data) < s->size)
+            s->offsets[line / s->stride] = nl + 1 - s->data;
+        p = nl + 1;
+    }
+
+    return NULL;
+}
+
+// Runs pass over every slice, one thread each
+static int run_pass(index_slice *slices, int threads, int pass)
+{
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    if (ids == NULL)
+        return -1;
+
+    int started = 0;
+    for (; started < threads; started++)
+    {
+        slices[started].pass = pass;
+        if (pthread_create(&ids[started], NULL, index_worker, &slices[started]) != 0)
+            break;
+    }
+    for (int t = 0; t < started; t++)
+        pthread_join(ids[t], NULL);
+
+    // A slice whose thread did not start is done here
+    for (int t = started; t < threads; t++)
+        index_worker(&slices[t]);
+
+    free(ids);
+    return 0;
+}
+
+// Build the index of the dump open as fd with size bytes
+static int build_index(line_index *index, int fd, size_t size, int threads)
+{
+    const char *data = NULL;
+
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            return -1;
+    }
+
+    if (threads < 1 || size < (size_t)threads * 4096)
+        threads = 1;
+
+    index_slice *slices = calloc(threads, sizeof(index_slice));
+    if (slices == NULL)
+        goto fail;
+
+    for (int t = 0; t < threads; t++)
+    {
+        slices[t].data = data;
+        slices[t].size = size;
+        slices[t].start = size / threads * t;
+        slices[t].end = t == threads - 1 ? size : size / threads * (t + 1);
+        slices[t].stride = LINE_INDEX_STRIDE;
+    }
+
+    if (run_pass(slices, threads, 1) != 0)
+        goto fail;
+
+    // Line numbers where the slices start come from a prefix sum of the counts
+    uint64_t newlines = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        slices[t].first_line = newlines;
+        newlines += slices[t].newlines;
+    }
+
+    // A last line without a newline still counts
+    index->header.lines = newlines + (size > 0 && data[size - 1] != '\n');
+    index->header.entries = (index->header.lines + LINE_INDEX_STRIDE - 1) / LINE_INDEX_STRIDE;
+    index->offsets = malloc((index->header.entries > 0 ? index->header.entries : 1) * sizeof(uint64_t));
+    if (index->offsets == NULL)
+        goto fail;
+    index->offsets[0] = 0;
+
+    for (int t = 0; t < threads; t++)
+        slices[t].offsets = index->offsets;
+    if (run_pass(slices, threads, 2) != 0)
+        goto fail;
+
+    free(slices);
+    if (size > 0)
+        munmap((void *)data, size);
+    return 0;
+
+fail:
+    free(slices);
+    free(index->offsets);
+    index->offsets = NULL;
+    if (size > 0)
+        munmap((void *)data, size);
+    return -1;
+}
+
+// Load the index at path if it is one for the dump described by want.
+// Returns 0 when it was loaded, -1 when it is missing or stale.
+static int load_index(line_index *index, const char *path, const line_index_header *want)
+{
+    line_index_header header;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    int valid = fread(&header, sizeof(header), 1, fp) == 1 &&
+                memcmp(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == LINE_INDEX_VERSION && header.stride == LINE_INDEX_STRIDE &&
+                header.file_size == want->file_size && header.mtime_sec == want->mtime_sec &&
+                header.mtime_nsec == want->mtime_nsec &&
+                header.entries == (header.lines + header.stride - 1) / header.stride;
+
+    if (valid)
+    {
+        index->offsets = malloc((header.entries > 0 ? header.entries : 1) * sizeof(uint64_t));
+        valid = index->offsets != NULL && fread(index->offsets, sizeof(uint64_t), header.entries, fp) == header.entries;
+    }
+    fclose(fp);
+
+    if (!valid)
+    {
+        free(index->offsets);
+        index->offsets = NULL;
+        return -1;
+    }
+
+    index->header = header;
+    return 0;
+}
+
+// Write the index to path through a temporary file, so a run killed while
+// saving never leaves half an index behind
+static int save_index(const line_index *index, const char *path)
+{
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *fp = fopen(temp, "wb");
+    if (fp == NULL)
+        return -1;
+
+    int ok = fwrite(&index->header, sizeof(index->header), 1, fp) == 1 &&
+             fwrite(index->offsets, sizeof(uint64_t), index->header.entries, fp) == index->header.entries;
+    if (fclose(fp) != 0 || !ok || rename(temp, path) != 0)
+    {
+        unlink(temp);
+        return -1;
+    }
+
+    return 0;
+}
+
+// LINE INDEX OPEN
+int line_index_open(line_index *index, const char *input_path, const char *index_path, int threads)
+{
+    char default_path[4096];
+    struct stat st;
+    double start = now();
+
+    memset(index, 0, sizeof(*index));
+
+    if (index_path == NULL)
+    {
+        if (snprintf(default_path, sizeof(default_path), "%s%s", input_path, LINE_INDEX_SUFFIX) >=
+            (int)sizeof(default_path))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        index_path = default_path;
+    }
+
+    int fd = open(input_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    line_index_header *header = &index->header;
+    memcpy(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic));
+    header->version = LINE_INDEX_VERSION;
+    header->stride = LINE_INDEX_STRIDE;
+    header->file_size = st.st_size;
+    header->mtime_sec = st.st_mtim.tv_sec;
+    header->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (load_index(index, index_path, header) != 0)
+    {
+        if (build_index(index, fd, st.st_size, threads) != 0)
+        {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        index->built = 1;
+        index->saved = save_index(index, index_path) == 0;
+    }
+    else
+        index->saved = 1;
+
+    close(fd);
+    index->seconds = now() - start;
+    return 0;
+}
+
+// LINE INDEX OFFSET
+int line_index_offset(const line_index *index, int fd, long line, uint64_t *offset)
+{
+    char block[65536];
+
+    if (line < 0 || (uint64_t)line > index->header.lines)
+    {
+        errno = ERANGE;
+        return -1;
+    }
+
+    // Starting right after the last line is allowed, it is the end of the dump
+    if ((uint64_t)line == index->header.lines)
+    {
+        *offset = index->header.file_size;
+        return 0;
+    }
+
+    uint64_t pos = index->offsets[line / index->header.stride];
+    long skip = line % index->header.stride;
+
+    while (skip > 0)
+    {
+        ssize_t got = pread(fd, block, sizeof(block), pos);
+        if (got < 0)
+            return -1;
+        if (got == 0)
+        {
+            errno = ERANGE;
+            return -1;
+        }
+
+        const char *p = block;
+        const char *end = block + got;
+        const char *nl;
+        while (skip > 0 && (nl = memchr(p, '\n', end - p)) != NULL)
+        {
+            p = nl + 1;
+            skip--;
+        }
+        pos += (skip > 0 ? end : p) - block;
+    }
+
+    *offset = pos;
+    return 0;
+}
+
+// LINE INDEX REPORT
+void line_index_report(FILE *fp, const line_index *index)
+{
+    fprintf(fp, "\nIndex: %s in %.6fs, %lu lines, every %lu%s", index->built ? "built" : "loaded", index->seconds,
+            (unsigned long)index->header.lines, (unsigned long)index->header.stride,
+            index->saved ? "" : " (not saved, kept in memory)");
+}
+
+// LINE INDEX FREE
+void line_index_free(line_index *index)
+{
+    free(index->offsets);
+    index->offsets = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// LINE INDEX
+// Sidecar file next to the dump (dump.txt.idx) with the byte offset of
+// every LINE_INDEX_STRIDE'th line, so a run can start at any line with one
+// seek and at most a stride of lines read forward, instead of getline from
+// byte 0. It is built the first time a run needs it, with threads counting
+// the newlines of their own slice of the mapped file and then recording the
+// offsets in it, and it only counts as valid for a dump of the same size
+// and modification time.
+//
+//     line_index_header
+//     uint64_t offset x entries    offset of line i * stride, entries = ceil(lines / stride)
+
+#define LINE_INDEX_MAGIC "3WAYIDX1"
+#define LINE_INDEX_VERSION 1
+#define LINE_INDEX_STRIDE 4096 // Lines between two offsets: 16 KB of index per 8M lines
+#define LINE_INDEX_SUFFIX ".idx"
+
+typedef struct
+{
+    char magic[8];      // LINE_INDEX_MAGIC, no NUL
+    uint32_t version;   // LINE_INDEX_VERSION
+    uint32_t reserved;
+    uint64_t stride;    // Lines between two offsets
+    uint64_t file_size; // Size and mtime of the dump the index is for
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t lines;     // Lines in the dump, the last one may lack its newline
+    uint64_t entries;
+} line_index_header;
+
+typedef struct
+{
+    line_index_header header;
+    uint64_t *offsets;
+    int built; // 1 when this run built it, 0 when it was loaded
+    int saved; // 0 when it could not be written next to the dump
+    double seconds; // Time to load or build it
+} line_index;
+
+// Load index_path (NULL for input_path + LINE_INDEX_SUFFIX) if it matches
+// the dump at input_path, or build it with threads threads and save it
+// there. A dump that cannot be written next to is indexed in memory only.
+// Returns 0, or -1 with errno set.
+int line_index_open(line_index *index, const char *input_path, const char *index_path, int threads);
+
+// Byte offset of line line of the dump open as fd: the entry at or before
+// it, then up to stride - 1 lines read forward. Returns 0, or -1 with
+// errno set (ERANGE when the dump has fewer lines).
+int line_index_offset(const line_index *index, int fd, long line, uint64_t *offset);
+
+// Write how the index was obtained to the times file
+void line_index_report(FILE *fp, const line_index *index);
+
+void line_index_free(line_index *index);
+
+#endif
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+
+#include "codepoint.h"
+#include "line_stats.h"
+
+enum
+{
+    CLASS_ALPHA,
+    CLASS_DIGIT,
+    CLASS_SPACE,
+    CLASS_PUNCT,
+    CLASS_OTHER
+};
+
+#define STAT_COUNT 6
+static const char *stat_names[STAT_COUNT] = {"max", "min", "length", "non_ascii", "classes", "codepoint"};
+static const char *class_names[STAT_CLASS_COUNT] = {"alpha", "digit", "space", "punct", "other"};
+
+// Class of every byte value, built once from the ASCII ranges (no locale)
+#define RANGE4(c) c, c, c, c
+#define RANGE16(c) RANGE4(c), RANGE4(c), RANGE4(c), RANGE4(c)
+static const unsigned char byte_class[256] = {
+    // 0x00 - 0x1f: control, except \t \n \v \f \r
+    CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER, CLASS_OTHER,
+    CLASS_OTHER, CLASS_SPACE, CLASS_SPACE, CLASS_SPACE, CLASS_SPACE, CLASS_SPACE, CLASS_OTHER, CLASS_OTHER,
+    RANGE16(CLASS_OTHER),
+    // 0x20 - 0x2f: space ! " # $ % & ' ( ) * + , - . /
+    CLASS_SPACE, RANGE4(CLASS_PUNCT), RANGE4(CLASS_PUNCT), RANGE4(CLASS_PUNCT), CLASS_PUNCT, CLASS_PUNCT, CLASS_PUNCT,
+    // 0x30 - 0x3f: 0-9 : ; < = > ?
+    RANGE4(CLASS_DIGIT), RANGE4(CLASS_DIGIT), CLASS_DIGIT, CLASS_DIGIT, RANGE4(CLASS_PUNCT), CLASS_PUNCT, CLASS_PUNCT,
+    // 0x40 - 0x5f: @ A-Z [ \ ] ^ _
+    CLASS_PUNCT, RANGE16(CLASS_ALPHA), RANGE4(CLASS_ALPHA), RANGE4(CLASS_ALPHA), CLASS_ALPHA, CLASS_ALPHA,
+    RANGE4(CLASS_PUNCT), CLASS_PUNCT,
+    // 0x60 - 0x7f: ` a-z { | } ~ DEL
+    CLASS_PUNCT, RANGE16(CLASS_ALPHA), RANGE4(CLASS_ALPHA), RANGE4(CLASS_ALPHA), CLASS_ALPHA, CLASS_ALPHA,
+    RANGE4(CLASS_PUNCT), CLASS_OTHER,
+    // 0x80 - 0xff
+    RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER),
+    RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER), RANGE16(CLASS_OTHER)};
+
+// 16 bytes as one vector, SSE2 on x86-64 and NEON on ARM with no intrinsics
+typedef unsigned char byte_vector __attribute__((vector_size(16)));
+
+// Larger of a and b in every lane (vector ?: is C++ only)
+#define VECTOR_MAX(a, b) (((a) & ~(byte_vector)((b) > (a))) | ((b) & (byte_vector)((b) > (a))))
+#define VECTOR_MIN(a, b) (((a) & ~(byte_vector)((b) < (a))) | ((b) & (byte_vector)((b) < (a))))
+
+// The one loop every kernel is made from. mask is a constant in each
+// caller, so after inlining the compiler drops every statistic that is off.
+//
+// Whole 16-byte blocks go through vector compares: max works on bytes with
+// the sign bit flipped, so unsigned order is signed order as in max_byte,
+// and each count subtracts the compare's 0xff (-1) per match in a byte
+// lane, added up every 255 blocks before a lane can wrap. The tail of the
+// line goes byte by byte. "other" is whatever is in no other class.
+static inline __attribute__((always_inline)) void scan_line(const unsigned char *p, size_t len, int *out,
+                                                            const unsigned mask)
+{
+    size_t text = len > 0 && p[len - 1] == '\n' ? len - 1 : len;
+    int max = text < len ? '\n' : 0;
+    int min = text > 0 ? 255 : 0;
+    int non_ascii = 0;
+    int classes[STAT_CLASS_COUNT] = {0};
+    byte_vector vmax = {0}, vmin = ~(byte_vector){0};
+    size_t i = 0;
+
+    while (i + 16 <= text)
+    {
+        byte_vector high = {0}, alpha = {0}, digit = {0}, space = {0}, punct = {0};
+        size_t stop = i + 16 * 255 < text ? i + 16 * 255 : text;
+
+        for (; i + 16 <= stop; i += 16)
+        {
+            byte_vector v;
+            memcpy(&v, p + i, 16);
+
+            if (mask & STAT_MAX)
+                vmax = VECTOR_MAX(vmax, v ^ 0x80);
+            if (mask & STAT_MIN)
+                vmin = VECTOR_MIN(vmin, v);
+            if (mask & STAT_NON_ASCII)
+                high += v >> 7;
+            if (mask & STAT_CLASSES)
+            {
+                byte_vector is_alpha = (byte_vector)(((v | 0x20) - (unsigned char)'a') < 26);
+                byte_vector is_digit = (byte_vector)((v - (unsigned char)'0') < 10);
+                alpha -= is_alpha;
+                digit -= is_digit;
+                space -= (byte_vector)(v == ' ') | (byte_vector)((v - 9) < 5);
+                punct -= (byte_vector)((v - 0x21) < 94) & ~is_alpha & ~is_digit;
+            }
+        }
+
+        for (int lane = 0; lane < 16; lane++)
+        {
+            non_ascii += high[lane];
+            classes[CLASS_ALPHA] += alpha[lane];
+            classes[CLASS_DIGIT] += digit[lane];
+            classes[CLASS_SPACE] += space[lane];
+            classes[CLASS_PUNCT] += punct[lane];
+        }
+    }
+
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if ((signed char)(vmax[lane] ^ 0x80) > max)
+            max = (signed char)(vmax[lane] ^ 0x80);
+        if (vmin[lane] < min)
+            min = vmin[lane];
+    }
+
+    for (; i < text; i++)
+    {
+        if (mask & STAT_MAX)
+            max = (signed char)p[i] > max ? (signed char)p[i] : max;
+        if (mask & STAT_MIN)
+            min = p[i] < min ? p[i] : min;
+        if (mask & STAT_NON_ASCII)
+            non_ascii += p[i] >= 0x80;
+        if (mask & STAT_CLASSES)
+            classes[byte_class[p[i]]]++;
+    }
+
+    int f = 0;
+    if (mask & STAT_MAX)
+        out[f++] = max;
+    if (mask & STAT_MIN)
+        out[f++] = min;
+    if (mask & STAT_LENGTH)
+        out[f++] = text;
+    if (mask & STAT_NON_ASCII)
+        out[f++] = non_ascii;
+    if (mask & STAT_CLASSES)
+    {
+        classes[CLASS_OTHER] = text - classes[CLASS_ALPHA] - classes[CLASS_DIGIT] - classes[CLASS_SPACE] -
+                               classes[CLASS_PUNCT];
+        for (int c = 0; c < STAT_CLASS_COUNT; c++)
+            out[f++] = classes[c];
+    }
+}
+
+#define STATS_KERNEL(mask)                                                         \
+    static void stats_kernel_##mask(const unsigned char *p, size_t len, int *out) \
+    {                                                                              \
+        scan_line(p, len, out, mask);                                              \
+    }
+
+STATS_KERNEL(1) STATS_KERNEL(2) STATS_KERNEL(3) STATS_KERNEL(4) STATS_KERNEL(5) STATS_KERNEL(6) STATS_KERNEL(7)
+STATS_KERNEL(8) STATS_KERNEL(9) STATS_KERNEL(10) STATS_KERNEL(11) STATS_KERNEL(12) STATS_KERNEL(13) STATS_KERNEL(14)
+STATS_KERNEL(15) STATS_KERNEL(16) STATS_KERNEL(17) STATS_KERNEL(18) STATS_KERNEL(19) STATS_KERNEL(20) STATS_KERNEL(21)
+STATS_KERNEL(22) STATS_KERNEL(23) STATS_KERNEL(24) STATS_KERNEL(25) STATS_KERNEL(26) STATS_KERNEL(27) STATS_KERNEL(28)
+STATS_KERNEL(29) STATS_KERNEL(30) STATS_KERNEL(31)
+
+// Indexed by mask
+static const stats_kernel kernels[STAT_BYTES + 1] = {
+    NULL,             stats_kernel_1,  stats_kernel_2,  stats_kernel_3,  stats_kernel_4,  stats_kernel_5,
+    stats_kernel_6,   stats_kernel_7,  stats_kernel_8,  stats_kernel_9,  stats_kernel_10, stats_kernel_11,
+    stats_kernel_12,  stats_kernel_13, stats_kernel_14, stats_kernel_15, stats_kernel_16, stats_kernel_17,
+    stats_kernel_18,  stats_kernel_19, stats_kernel_20, stats_kernel_21, stats_kernel_22, stats_kernel_23,
+    stats_kernel_24,  stats_kernel_25, stats_kernel_26, stats_kernel_27, stats_kernel_28, stats_kernel_29,
+    stats_kernel_30,  stats_kernel_31};
+
+// LINE STATS PARSE
+int line_stats_parse(const char *list, unsigned *mask)
+{
+    *mask = 0;
+
+    while (*list != '\0')
+    {
+        size_t length = strcspn(list, ",");
+        unsigned flag = 0;
+
+        if (length == 3 && strncmp(list, "all", 3) == 0)
+            flag = STAT_ALL;
+        for (int s = 0; s < STAT_COUNT; s++)
+        {
+            if (strlen(stat_names[s]) == length && strncmp(list, stat_names[s], length) == 0)
+                flag = 1u << s;
+        }
+        if (flag == 0)
+            return -1;
+
+        *mask |= flag;
+        list += length;
+        if (*list == ',')
+            list++;
+    }
+
+    return *mask != 0 ? 0 : -1;
+}
+
+// LINE STATS INIT
+void line_stats_init(line_stats *stats, unsigned mask)
+{
+    stats->mask = mask & STAT_ALL;
+    stats->fields = 0;
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        if (stats->mask & (1u << s))
+            stats->fields += (1u << s) == STAT_CLASSES ? STAT_CLASS_COUNT : (1u << s) == STAT_CODEPOINT ? 2 : 1;
+    }
+    stats->kernel = kernels[stats->mask & STAT_BYTES];
+}
+
+// LINE STATS LINES
+void line_stats_lines(const line_stats *stats, int *values, const char *bytes, const uint32_t *line_offsets,
+                      long start, long end)
+{
+    const stats_kernel kernel = stats->kernel;
+    const int fields = stats->fields;
+    const int codepoint = stats->mask & STAT_CODEPOINT;
+
+    for (long i = start; i < end; i++)
+    {
+        const unsigned char *p = (const unsigned char *)bytes + line_offsets[i];
+        size_t len = line_offsets[i + 1] - line_offsets[i];
+
+        if (kernel != NULL)
+            kernel(p, len, values + i * fields);
+        // Its two results are the last columns
+        if (codepoint)
+            codepoint_scan(p, len, values + i * fields + fields - 2);
+    }
+}
+
+// LINE STATS SCHEMA
+void line_stats_schema(char *out, unsigned mask)
+{
+    strcpy(out, "line:");
+
+    for (int s = 0; s < STAT_COUNT; s++)
+    {
+        if (!(mask & (1u << s)))
+            continue;
+
+        if ((1u << s) == STAT_CODEPOINT)
+        {
+            strcat(out, " codepoint invalid");
+            continue;
+        }
+        if ((1u << s) != STAT_CLASSES)
+        {
+            strcat(strcat(out, " "), stat_names[s]);
+            continue;
+        }
+        for (int c = 0; c < STAT_CLASS_COUNT; c++)
+            strcat(strcat(out, " "), class_names[c]);
+    }
+}
+
+// LINE STATS WRITE SCHEMA
+int line_stats_write_schema(int fd, unsigned mask)
+{
+    char header[STATS_SCHEMA_MAX + 3] = "# ";
+
+    line_stats_schema(header + 2, mask);
+    strcat(header, "\n");
+
+    size_t length = strlen(header);
+    return write(fd, header, length) == (ssize_t)length ? 0 : -1;
+}
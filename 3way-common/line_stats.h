@@ -0,0 +1,72 @@
+#ifndef LINE_STATS_H
+#define LINE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LINE STATS
+// Several statistics of every line in one pass over its bytes (--stats=).
+// Every combination of statistics has its own kernel, stamped out by a
+// macro from one loop in which the choice is a compile-time constant, so
+// the kernel picked at startup tests nothing per byte it does not compute
+// and every byte is loaded once however many statistics are asked for.
+// codepoint is the exception: it decodes UTF-8 across byte boundaries, so
+// it runs its own vector loop (codepoint.c) over the line afterwards.
+//
+//   max        max ASCII value, as max_byte (signed bytes, newline included)
+//   min        smallest byte of the line without its newline (0 if empty)
+//   length     bytes in the line without its newline
+//   non_ascii  bytes >= 0x80, non-zero for UTF-8 text outside ASCII
+//   classes    five counts: letters, digits, whitespace, punctuation and
+//              everything else (control bytes and bytes >= 0x80)
+//   codepoint  two: the max Unicode code point of the line read as UTF-8
+//              (newline included, as max) and its invalid sequences
+//
+// The results of line i are batch_value_fields ints in the order above,
+// and each output line is "line: value value ...". The schema line
+// "# line: max min ..." goes first on stdout and in the times file.
+
+#define STAT_MAX 1
+#define STAT_MIN 2
+#define STAT_LENGTH 4
+#define STAT_NON_ASCII 8
+#define STAT_CLASSES 16
+#define STAT_CODEPOINT 32
+#define STAT_BYTES 31 // The statistics of the fused byte kernels
+#define STAT_ALL 63
+
+#define STAT_CLASS_COUNT 5
+#define STATS_FIELDS_MAX (4 + STAT_CLASS_COUNT + 2)
+#define STATS_SCHEMA_MAX 96 // "line: max min length non_ascii alpha digit space punct other codepoint invalid"
+
+// Writes the results of the len bytes at p to out
+typedef void (*stats_kernel)(const unsigned char *p, size_t len, int *out);
+
+typedef struct
+{
+    unsigned mask;       // STAT_* flags
+    int fields;          // Results per line
+    stats_kernel kernel; // Kernel specialized for mask & STAT_BYTES, NULL if none of them
+} line_stats;
+
+// Comma-separated names ("max,length,classes" or "all") to STAT_* flags.
+// Returns 0, or -1 for an unknown name or an empty list.
+int line_stats_parse(const char *list, unsigned *mask);
+
+// Pick the kernel for mask (non-zero)
+void line_stats_init(line_stats *stats, unsigned mask);
+
+// Results of lines [start, end) into values, fields ints per line from
+// values + start * fields. Line i is bytes + line_offsets[i] up to line_offsets[i + 1].
+void line_stats_lines(const line_stats *stats, int *values, const char *bytes, const uint32_t *line_offsets,
+                      long start, long end);
+
+// "line: max min ..." for mask, the names of the output columns, into out
+// (STATS_SCHEMA_MAX bytes)
+void line_stats_schema(char *out, unsigned mask);
+
+// Write "# " and the schema as the first line of the output on fd.
+// Returns 0, or -1 with errno set.
+int line_stats_write_schema(int fd, unsigned mask);
+
+#endif
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "mapped_input.h"
+
+// 16 bytes as one vector, SSE2 on x86-64 and NEON on ARM, as in line_stats.c
+typedef char byte_vector __attribute__((vector_size(16)));
+typedef uint64_t word_vector __attribute__((vector_size(16)));
+
+// FIND LINE END
+// Offset of the first newline or NUL in the n bytes at p, n when there is
+// neither, both found in the same pass. 32 bytes a step with two vector
+// compares each, the first hit is the lowest set byte of its 64-bit word
+// (little-endian, as on x86-64 and ARM), and only the last bytes of the
+// file go byte by byte.
+static size_t find_line_end_vector(const char *p, size_t n)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        byte_vector a, b;
+        memcpy(&a, p + i, 16);
+        memcpy(&b, p + i + 16, 16);
+        word_vector hit_a = (word_vector)((a == '\n') | (a == 0));
+        word_vector hit_b = (word_vector)((b == '\n') | (b == 0));
+        word_vector hit = hit_a | hit_b;
+        if ((hit[0] | hit[1]) == 0)
+            continue;
+
+        uint64_t words[4] = {hit_a[0], hit_a[1], hit_b[0], hit_b[1]};
+        for (int w = 0;; w++)
+        {
+            if (words[w] != 0)
+                return i + w * 8 + __builtin_ctzll(words[w]) / 8;
+        }
+    }
+
+    for (; i < n; i++)
+    {
+        if (p[i] == '\n' || p[i] == '\0')
+            return i;
+    }
+    return n;
+}
+
+#ifdef HAVE_X86_SIMD
+
+// 128 bytes per iteration. A byte is a newline or a NUL exactly when
+// min(b, b ^ '\n') is 0, so four vectors fold into one test the way
+// glibc's memchr does for one byte, and the NUL costs next to nothing over
+// looking for the newline alone. The block with the hit is not read again.
+__attribute__((target("avx2"))) static size_t find_line_end_avx2(const char *p, size_t n)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+#define HITS(v) _mm256_min_epu8((v), _mm256_xor_si256((v), newline))
+#define MASK(v) (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), zero))
+    for (; i + 128 <= n; i += 128)
+    {
+        __m256i a = HITS(_mm256_loadu_si256((const __m256i *)(p + i)));
+        __m256i b = HITS(_mm256_loadu_si256((const __m256i *)(p + i + 32)));
+        __m256i c = HITS(_mm256_loadu_si256((const __m256i *)(p + i + 64)));
+        __m256i d = HITS(_mm256_loadu_si256((const __m256i *)(p + i + 96)));
+        if (MASK(_mm256_min_epu8(_mm256_min_epu8(a, b), _mm256_min_epu8(c, d))) == 0)
+            continue;
+
+        uint64_t low = MASK(a) | (uint64_t)MASK(b) << 32;
+        if (low != 0)
+            return i + __builtin_ctzll(low);
+        return i + 64 + __builtin_ctzll(MASK(c) | (uint64_t)MASK(d) << 32);
+    }
+    for (; i + 32 <= n; i += 32)
+    {
+        uint32_t mask = MASK(HITS(_mm256_loadu_si256((const __m256i *)(p + i))));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#undef HITS
+#undef MASK
+
+    return i + find_line_end_vector(p + i, n - i);
+}
+
+#endif
+
+// Picked in mapped_input_open, before any reader thread runs
+static size_t (*find_line_end)(const char *p, size_t n) = find_line_end_vector;
+
+// MAPPED INPUT OPEN
+// Maps the whole file read-only. The descriptor is closed right away since
+// the mapping keeps the file alive on its own.
+int mapped_input_open(mapped_input *in, const char *path)
+{
+    struct stat st;
+
+    memset(in, 0, sizeof(*in));
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        find_line_end = find_line_end_avx2;
+#endif
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    in->size = (size_t)st.st_size;
+
+    // mmap refuses a zero length, an empty file simply has no lines
+    if (in->size > 0)
+    {
+        void *map = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+
+        // The dump is read front to back exactly once
+        madvise(map, in->size, MADV_SEQUENTIAL);
+        in->data = map;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// MAPPED INPUT INDEX
+// Finds the next max_lines newlines and records where each line starts.
+// The same scan stops at a NUL, so a line holding one costs a memchr for
+// the rest of it and nothing else does. A last line without a newline
+// still counts.
+long mapped_input_index(mapped_input *in, uint32_t *offsets, long max_lines, size_t max_bytes, size_t *start,
+                        int *has_nul)
+{
+    long lines_read = 0;
+
+    if (max_bytes > UINT32_MAX)
+        max_bytes = UINT32_MAX;
+
+    *start = in->pos;
+    *has_nul = 0;
+    offsets[0] = 0;
+
+    while (lines_read < max_lines && in->pos < in->size)
+    {
+        const char *line = in->data + in->pos;
+        size_t left = in->size - in->pos;
+        size_t end = find_line_end(line, left);
+        int nul = end < left && line[end] == '\0';
+
+        if (nul)
+        {
+            const char *nl = memchr(line + end, '\n', left - end);
+            end = nl == NULL ? left : (size_t)(nl - line);
+        }
+        size_t length = end < left ? end + 1 : left;
+
+        // Batch is full (offsets are 32 bits), the line goes in the next batch
+        if (in->pos + length - *start > max_bytes && lines_read > 0)
+            break;
+
+        *has_nul |= nul;
+        in->pos += length;
+        lines_read++;
+        offsets[lines_read] = in->pos - *start;
+    }
+
+    return lines_read;
+}
+
+// MAPPED INPUT SEEK
+// Nothing below offset is ever touched, so there is nothing to release there either
+void mapped_input_seek(mapped_input *in, size_t offset)
+{
+    in->pos = offset < in->size ? offset : in->size;
+    in->released = in->pos & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+}
+
+// MAPPED INPUT RELEASE
+// Tells the kernel the pages below upto will not be read again
+void mapped_input_release(mapped_input *in, size_t upto)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t end = upto - (upto % (size_t)page);
+
+    if (in->data == NULL || end <= in->released)
+    {
+        return;
+    }
+
+    madvise((char *)in->data + in->released, end - in->released, MADV_DONTNEED);
+    in->released = end;
+}
+
+// MAPPED INPUT CLOSE
+void mapped_input_close(mapped_input *in)
+{
+    if (in->data != NULL)
+    {
+        munmap((void *)in->data, in->size);
+    }
+
+    memset(in, 0, sizeof(*in));
+}
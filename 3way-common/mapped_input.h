@@ -0,0 +1,46 @@
+#ifndef MAPPED_INPUT_H
+#define MAPPED_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MAPPED INPUT
+// Zero-copy view of the wiki dump. The whole file is mmap'd once and each
+// batch is described by a small array of line offsets that point straight
+// into the mapping, so no line is ever copied or malloc'd. A batch with a
+// line holding an embedded NUL is the one exception: getline mode reads
+// the bytes after it as 0, so the reader copies that batch into its arena
+// with batch_copy_lines instead of scanning the read-only mapping.
+
+// Memory-mapped input file
+typedef struct
+{
+    const char *data; // Start of the mapping (NULL for an empty file)
+    size_t size;      // Size of the file in bytes
+    size_t pos;       // Offset of the next line that has not been indexed
+    size_t released;  // Bytes below this offset were handed back to the kernel
+} mapped_input;
+
+// Map the file at path read-only. Returns 0 on success, -1 with errno set.
+int mapped_input_open(mapped_input *in, const char *path);
+
+// Index up to max_lines lines starting at the current position. *start is
+// set to the file offset of the first one and offsets[] to lines + 1 offsets
+// from there (the layout of a line_batch). Stops early rather than go past
+// max_bytes (or 4 GiB), but always takes at least one line. *has_nul is
+// set when one of the lines holds an embedded NUL.
+// Returns the number of lines indexed (0 at end of file)
+long mapped_input_index(mapped_input *in, uint32_t *offsets, long max_lines, size_t max_bytes, size_t *start,
+                        int *has_nul);
+
+// Continue indexing at offset, the start of a line (--start)
+void mapped_input_seek(mapped_input *in, size_t offset);
+
+// Drop the resident pages below offset upto once every line there is done,
+// so peak RSS stays bounded by the batch instead of growing with the file
+void mapped_input_release(mapped_input *in, size_t upto);
+
+// Unmap the file
+void mapped_input_close(mapped_input *in);
+
+#endif
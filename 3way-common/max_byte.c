@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "max_byte.h"
+
+static int max_byte_resolve(const char *p, size_t len);
+
+int (*max_byte)(const char *p, size_t len) = max_byte_resolve;
+static const char *selected_isa = "scalar";
+
+// MAX BYTE SCALAR
+int max_byte_scalar(const char *p, size_t len)
+{
+    int max = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if ((int)p[i] > max)
+        {
+            max = (int)p[i];
+        }
+    }
+
+    return max;
+}
+
+#ifdef HAVE_X86_SIMD
+
+// Every byte is XORed with 0x80 before the unsigned max: -128..127 maps to
+// 0..255 in the same order. The accumulators start at 0x80 (a signed 0),
+// which also gives the "never below 0" floor of the scalar loop.
+
+// Horizontal max of the 16 unsigned bytes of v, converted back to signed
+__attribute__((target("sse2"))) static int reduce_sse2(__m128i v)
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return (_mm_cvtsi128_si32(v) & 0xff) - 0x80;
+}
+
+// MAX BYTE SSE2
+// 64 bytes per iteration in four independent accumulators
+__attribute__((target("sse2"))) static int max_byte_sse2(const char *p, size_t len)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64)
+    {
+        acc0 = _mm_max_epu8(acc0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias));
+        acc1 = _mm_max_epu8(acc1, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 16)), bias));
+        acc2 = _mm_max_epu8(acc2, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 32)), bias));
+        acc3 = _mm_max_epu8(acc3, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i + 48)), bias));
+    }
+    for (; i + 16 <= len; i += 16)
+    {
+        acc0 = _mm_max_epu8(acc0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias));
+    }
+
+    acc0 = _mm_max_epu8(_mm_max_epu8(acc0, acc1), _mm_max_epu8(acc2, acc3));
+    int max = reduce_sse2(acc0);
+    int tail = max_byte_scalar(p + i, len - i);
+
+    return tail > max ? tail : max;
+}
+
+// MAX BYTE AVX2
+// 128 bytes per iteration in four independent accumulators
+__attribute__((target("avx2"))) static int max_byte_avx2(const char *p, size_t len)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i acc0 = bias, acc1 = bias, acc2 = bias, acc3 = bias;
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128)
+    {
+        acc0 = _mm256_max_epu8(acc0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), bias));
+        acc1 = _mm256_max_epu8(acc1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i + 32)), bias));
+        acc2 = _mm256_max_epu8(acc2, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i + 64)), bias));
+        acc3 = _mm256_max_epu8(acc3, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i + 96)), bias));
+    }
+    for (; i + 32 <= len; i += 32)
+    {
+        acc0 = _mm256_max_epu8(acc0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p + i)), bias));
+    }
+
+    acc0 = _mm256_max_epu8(_mm256_max_epu8(acc0, acc1), _mm256_max_epu8(acc2, acc3));
+    __m128i half = _mm_max_epu8(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    int max = reduce_sse2(half);
+    int tail = max_byte_scalar(p + i, len - i);
+
+    return tail > max ? tail : max;
+}
+
+// MAX BYTE AVX-512
+// The tail is a masked load instead of a scalar loop: masked-off bytes
+// load as 0, which becomes 0x80 after the XOR and can never win
+__attribute__((target("avx512f,avx512bw"))) static int max_byte_avx512(const char *p, size_t len)
+{
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+    __m512i acc0 = bias, acc1 = bias;
+    size_t i = 0;
+
+    for (; i + 128 <= len; i += 128)
+    {
+        acc0 = _mm512_max_epu8(acc0, _mm512_xor_si512(_mm512_loadu_si512(p + i), bias));
+        acc1 = _mm512_max_epu8(acc1, _mm512_xor_si512(_mm512_loadu_si512(p + i + 64), bias));
+    }
+    for (; i < len; i += 64)
+    {
+        size_t left = len - i;
+        __mmask64 mask = left >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << left) - 1);
+        acc0 = _mm512_max_epu8(acc0, _mm512_xor_si512(_mm512_maskz_loadu_epi8(mask, p + i), bias));
+    }
+
+    acc0 = _mm512_max_epu8(acc0, acc1);
+    __m256i quarter = _mm256_max_epu8(_mm512_castsi512_si256(acc0), _mm512_extracti64x4_epi64(acc0, 1));
+    __m128i half = _mm_max_epu8(_mm256_castsi256_si128(quarter), _mm256_extracti128_si256(quarter, 1));
+    return reduce_sse2(half);
+}
+
+#endif
+
+// MAX BYTE RESOLVE
+// First call of max_byte: picks the version and replaces the pointer.
+// Threads racing through here all store the same value.
+static int max_byte_resolve(const char *p, size_t len)
+{
+    const char *force = getenv("MAX_BYTE_ISA");
+    if (force != NULL && *force == '\0')
+        force = NULL;
+
+    int (*impl)(const char *, size_t) = max_byte_scalar;
+    const char *isa = "scalar";
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw") && (force == NULL || strcmp(force, "avx512") == 0))
+    {
+        impl = max_byte_avx512;
+        isa = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "avx2") == 0))
+    {
+        impl = max_byte_avx2;
+        isa = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2") && (force == NULL || strcmp(force, "sse2") == 0))
+    {
+        impl = max_byte_sse2;
+        isa = "sse2";
+    }
+#endif
+
+    selected_isa = isa;
+    max_byte = impl;
+    return impl(p, len);
+}
+
+// MAX BYTE ISA
+const char *max_byte_isa()
+{
+    if (max_byte == max_byte_resolve)
+    {
+        max_byte_resolve("", 0);
+    }
+
+    return selected_isa;
+}
@@ -0,0 +1,26 @@
+#ifndef MAX_BYTE_H
+#define MAX_BYTE_H
+
+#include <stddef.h>
+
+// MAX BYTE
+// Max ASCII value of a line, the kernel every backend runs per line.
+// Bytes are compared as signed char like the original loop, so a byte
+// >= 0x80 never wins and an empty line gives 0.
+//
+// The vector versions flip the sign bit of every byte so that signed
+// order becomes unsigned order, then use the packed unsigned max
+// (pmaxub / vpmaxub) and a horizontal reduction at the end. The best
+// version the CPU supports is picked on the first call with CPUID, the
+// MAX_BYTE_ISA environment variable (scalar, sse2, avx2, avx512) forces one.
+
+// Max ASCII value of the len bytes at p
+extern int (*max_byte)(const char *p, size_t len);
+
+// Plain byte-at-a-time loop, the reference the vector versions must match
+int max_byte_scalar(const char *p, size_t len);
+
+// Name of the version max_byte dispatches to ("scalar", "sse2", "avx2" or "avx512")
+const char *max_byte_isa();
+
+#endif
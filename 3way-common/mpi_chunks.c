@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpi_chunks.h"
+#include "trace.h"
+
+#define PACKET_HEADER (3 * sizeof(long)) // first_line, lines and file_offset
+#define SCATTER_HEADER 4                 // Longs per rank ahead of the packets: lines_in_batch, packet size, offset, with_bytes
+
+// Packets start on 8-byte boundaries so the header inside stays aligned
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+// Make sure the packet buffer holds at least size bytes
+static int grow_packets(mpi_chunk *chunk, size_t size)
+{
+    if (size <= chunk->packets_size)
+        return 0;
+
+    char *temp = realloc(chunk->packets, size);
+    if (temp == NULL)
+        return -1;
+
+    chunk->packets = temp;
+    chunk->packets_size = size;
+    trace_count(COUNTER_ALLOCATIONS, 1);
+    return 0;
+}
+
+// CHUNK RANGE
+// Splits the remainder over the ranks so chunk sizes differ by at most one line
+void chunk_range(long lines, int rank, int size, long *start, long *end)
+{
+    *start = rank * lines / size;
+    *end = (rank + 1) * lines / size;
+}
+
+// CHUNK INIT
+int chunk_init(mpi_chunk *chunk, int size)
+{
+    memset(chunk, 0, sizeof(*chunk));
+
+    chunk->headers = malloc(SCATTER_HEADER * size * sizeof(long));
+    chunk->counts = malloc(size * sizeof(int));
+    chunk->displs = malloc(size * sizeof(int));
+
+    return (chunk->headers == NULL || chunk->counts == NULL || chunk->displs == NULL) ? -1 : 0;
+}
+
+// CHUNK FREE
+void chunk_free(mpi_chunk *chunk)
+{
+    free(chunk->packets);
+    free(chunk->headers);
+    free(chunk->counts);
+    free(chunk->displs);
+    memset(chunk, 0, sizeof(*chunk));
+}
+
+// PACK BATCH
+// Rank 0: lays out one packet per rank in chunk->packets
+static int pack_batch(mpi_chunk *chunk, const line_batch *batch, int with_bytes, int size)
+{
+    long lines = batch == NULL ? 0 : batch->lines;
+    size_t total = 0;
+
+    // Packet sizes and offsets
+    for (int r = 0; r < size; r++)
+    {
+        long start, end;
+        size_t packet = 0;
+
+        if (lines > 0)
+        {
+            chunk_range(lines, r, size, &start, &end);
+
+            size_t bytes = with_bytes ? batch->line_offsets[end] - batch->line_offsets[start] : 0;
+            packet = align8(PACKET_HEADER + (end - start + 1) * sizeof(uint32_t) + bytes);
+        }
+
+        chunk->headers[SCATTER_HEADER * r] = lines;
+        chunk->headers[SCATTER_HEADER * r + 1] = packet;
+        chunk->headers[SCATTER_HEADER * r + 2] = batch == NULL ? 0 : batch->offset;
+        chunk->headers[SCATTER_HEADER * r + 3] = with_bytes;
+        chunk->counts[r] = packet;
+        chunk->displs[r] = total;
+        total += packet;
+    }
+
+    if (lines == 0)
+        return 0;
+
+    if (grow_packets(chunk, total) != 0)
+        return -1;
+
+    // Each rank's offsets, then its lines in one piece
+    for (int r = 0; r < size; r++)
+    {
+        long start, end;
+        chunk_range(lines, r, size, &start, &end);
+
+        char *packet = chunk->packets + chunk->displs[r];
+        long *header = (long *)packet;
+        uint32_t *offsets = (uint32_t *)(packet + PACKET_HEADER);
+        uint32_t base = batch->line_offsets[start];
+
+        header[0] = start;
+        header[1] = end - start;
+        header[2] = batch->file_offset + base;
+
+        for (long i = start; i <= end; i++)
+            offsets[i - start] = batch->line_offsets[i] - base;
+
+        if (with_bytes)
+            memcpy(offsets + (end - start + 1), batch->bytes + base, batch->line_offsets[end] - base);
+    }
+
+    return 0;
+}
+
+// CHUNK SCATTER
+long chunk_scatter(mpi_chunk *chunk, const line_batch *batch, int with_bytes, MPI_Comm comm)
+{
+    int rank, size;
+    long header[SCATTER_HEADER];
+    char *packet;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    if (rank == 0)
+    {
+        if (pack_batch(chunk, batch, with_bytes, size) != 0)
+        {
+            perror("Error allocating memory for the MPI packets");
+            MPI_Abort(comm, 1);
+        }
+
+        MPI_Scatter(chunk->headers, SCATTER_HEADER, MPI_LONG, header, SCATTER_HEADER, MPI_LONG, 0, comm);
+
+        // Rank 0's own packet stays where it is
+        if (header[0] > 0)
+            MPI_Scatterv(chunk->packets, chunk->counts, chunk->displs, MPI_BYTE, MPI_IN_PLACE, 0, MPI_BYTE, 0, comm);
+
+        packet = chunk->packets + chunk->displs[0];
+    }
+    else
+    {
+        MPI_Scatter(NULL, SCATTER_HEADER, MPI_LONG, header, SCATTER_HEADER, MPI_LONG, 0, comm);
+
+        if (header[0] > 0)
+        {
+            if (grow_packets(chunk, header[1]) != 0)
+            {
+                perror("Error allocating memory for the MPI packet");
+                MPI_Abort(comm, 1);
+            }
+
+            MPI_Scatterv(NULL, NULL, NULL, MPI_BYTE, chunk->packets, header[1], MPI_BYTE, 0, comm);
+        }
+
+        packet = chunk->packets;
+    }
+
+    chunk->lines_in_batch = header[0];
+    chunk->offset = header[2];
+    if (header[0] == 0)
+    {
+        chunk->lines = 0;
+        return 0;
+    }
+
+    // Unpack the header and point into the packet
+    chunk->first_line = ((long *)packet)[0];
+    chunk->lines = ((long *)packet)[1];
+    chunk->file_offset = ((long *)packet)[2];
+    chunk->line_offsets = (uint32_t *)(packet + PACKET_HEADER);
+    chunk->bytes = header[3] ? (const char *)(chunk->line_offsets + chunk->lines + 1) : NULL;
+
+    return header[0];
+}
+
+// RESULTS INIT
+int results_init(mpi_results *res, int size)
+{
+    memset(res, 0, sizeof(*res));
+    res->request = MPI_REQUEST_NULL;
+    res->counts = malloc(size * sizeof(int));
+    res->displs = malloc(size * sizeof(int));
+
+    return (res->counts == NULL || res->displs == NULL) ? -1 : 0;
+}
+
+// RESULTS FREE
+void results_free(mpi_results *res)
+{
+    results_wait(res);
+    free(res->values);
+    free(res->text);
+    free(res->counts);
+    free(res->displs);
+    memset(res, 0, sizeof(*res));
+}
+
+// RESULTS VALUES
+// A rank with more ranks than lines in the batch gets 0 of them, it still
+// gets a buffer (realloc of 0 bytes may return NULL)
+int *results_values(mpi_results *res, long lines)
+{
+    if (lines < 1)
+        lines = 1;
+
+    if (lines > res->values_capacity)
+    {
+        int *temp = realloc(res->values, lines * batch_value_fields * sizeof(int));
+        if (temp == NULL)
+            return NULL;
+
+        res->values = temp;
+        res->values_capacity = lines;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    return res->values;
+}
+
+// RESULTS TEXT
+char *results_text(mpi_results *res, size_t length)
+{
+    if (length < 1)
+        length = 1;
+
+    if (length > res->text_capacity)
+    {
+        char *temp = realloc(res->text, length);
+        if (temp == NULL)
+            return NULL;
+
+        res->text = temp;
+        res->text_capacity = length;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    return res->text;
+}
+
+// RESULTS GATHER VALUES
+void results_gather_values(mpi_results *res, const mpi_chunk *chunk, int *root_values, MPI_Comm comm)
+{
+    int rank, size;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    if (rank == 0)
+    {
+        // Per-rank counts and displacements follow chunk_range exactly
+        for (int r = 0; r < size; r++)
+        {
+            long start, end;
+            chunk_range(chunk->lines_in_batch, r, size, &start, &end);
+            res->counts[r] = (end - start) * batch_value_fields;
+            res->displs[r] = start * batch_value_fields;
+        }
+
+        MPI_Igatherv(MPI_IN_PLACE, 0, MPI_INT, root_values, res->counts, res->displs, MPI_INT, 0, comm,
+                     &res->request);
+    }
+    else
+    {
+        MPI_Igatherv(res->values, chunk->lines * batch_value_fields, MPI_INT, NULL, NULL, NULL, MPI_INT, 0, comm, &res->request);
+    }
+}
+
+// RESULTS GATHER TEXT
+void results_gather_text(mpi_results *res, size_t length, line_batch *root_batch, MPI_Comm comm)
+{
+    int rank, size;
+    int count = length;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // The text lengths differ per rank, rank 0 needs them before it can post the receive
+    MPI_Gather(&count, 1, MPI_INT, res->counts, 1, MPI_INT, 0, comm);
+
+    if (rank == 0)
+    {
+        size_t total = 0;
+        for (int r = 0; r < size; r++)
+        {
+            res->displs[r] = total;
+            total += res->counts[r];
+        }
+
+        if (total > root_batch->output_capacity)
+        {
+            char *temp = realloc(root_batch->output, total);
+            if (temp == NULL)
+            {
+                perror("Error allocating memory for the batch output");
+                MPI_Abort(comm, 1);
+            }
+            root_batch->output = temp;
+            root_batch->output_capacity = total;
+            trace_count(COUNTER_ALLOCATIONS, 1);
+        }
+        root_batch->output_length = total;
+
+        MPI_Igatherv(res->text, count, MPI_CHAR, root_batch->output, res->counts, res->displs, MPI_CHAR, 0, comm,
+                     &res->request);
+    }
+    else
+    {
+        MPI_Igatherv(res->text, count, MPI_CHAR, NULL, NULL, NULL, MPI_CHAR, 0, comm, &res->request);
+    }
+}
+
+// RESULTS WAIT
+void results_wait(mpi_results *res)
+{
+    if (res->request != MPI_REQUEST_NULL)
+        MPI_Wait(&res->request, MPI_STATUS_IGNORE);
+}
@@ -0,0 +1,89 @@
+#ifndef MPI_CHUNKS_H
+#define MPI_CHUNKS_H
+
+#include <mpi.h>
+
+#include "batch.h"
+
+// MPI CHUNKS
+// Hands every rank only its own slice of a batch. Rank 0 packs each
+// rank's lines into one contiguous packet:
+//
+//     [first_line][lines][file_offset][lines + 1 offsets][line bytes, back to back]
+//
+// and sends all packets with a single MPI_Scatterv (after one MPI_Scatter
+// of the packet sizes), so a batch costs O(ranks) messages instead of one
+// broadcast per line. A chunk is a run of consecutive lines of the batch,
+// so its bytes go in with one memcpy and its offsets are the batch's
+// offsets moved down to start at 0. In mmap mode the packet carries no
+// bytes, every rank reads them from its own mapping at file_offset, unless
+// rank 0 copied the batch to zero what follows an embedded NUL.
+
+// This rank's part of the current batch
+typedef struct
+{
+    long lines_in_batch;    // Lines in the whole batch, 0 once the input is done
+    long offset;            // Line number of the first line in the batch
+    long first_line;        // Index inside the batch of this rank's first line
+    long lines;             // Lines in this rank's chunk
+    uint32_t *line_offsets; // lines + 1 offsets into the chunk's bytes
+    const char *bytes;      // Line bytes of the chunk (NULL when the packet has none, read the mapping)
+    size_t file_offset;     // File offset of the chunk's first line
+
+    // Buffers reused from batch to batch
+    char *packets;        // Rank 0: every rank's packet; other ranks: their own
+    size_t packets_size;
+    long *headers;        // Rank 0: lines_in_batch, packet size, offset and with_bytes for every rank
+    int *counts;          // Rank 0: packet size per rank
+    int *displs;          // Rank 0: packet offset per rank
+} mpi_chunk;
+
+// Range of batch lines [start, end) that rank gets out of lines
+void chunk_range(long lines, int rank, int size, long *start, long *end);
+
+// Allocate the per-rank bookkeeping for a communicator of size ranks
+int chunk_init(mpi_chunk *chunk, int size);
+void chunk_free(mpi_chunk *chunk);
+
+// Collective over comm. Rank 0 passes the batch (NULL once the input is
+// done), the other ranks pass NULL and get their chunk filled in. Rank
+// 0's with_bytes is 0 when every rank can read the lines from its own
+// mapping; the other ranks' is ignored. Returns lines_in_batch, 0 at the end.
+long chunk_scatter(mpi_chunk *chunk, const line_batch *batch, int with_bytes, MPI_Comm comm);
+
+// MPI RESULTS
+// Collects one batch's results on rank 0 with MPI_Igatherv. Every rank
+// sends exactly the lines of its chunk, so uneven tails arrive in full.
+// Two of these alternate so the gather of batch N is still in flight while
+// batch N+1 is scattered and computed; results_wait finishes it.
+typedef struct
+{
+    int *values;          // This rank's results (rank 0 computes straight into the batch)
+    long values_capacity;
+    char *text;           // This rank's formatted results (--gather=text)
+    size_t text_capacity;
+    int *counts;          // Rank 0: what each rank sends
+    int *displs;          // Rank 0: where it lands
+    MPI_Request request;
+} mpi_results;
+
+int results_init(mpi_results *res, int size);
+void results_free(mpi_results *res);
+
+// Room for lines results (batch_value_fields each) / length bytes of text. Returns NULL when out of memory.
+int *results_values(mpi_results *res, long lines);
+char *results_text(mpi_results *res, size_t length);
+
+// Start gathering the chunk's results into root_values (rank 0 only).
+// Rank 0's own results must already be at root_values + chunk->first_line.
+void results_gather_values(mpi_results *res, const mpi_chunk *chunk, int *root_values, MPI_Comm comm);
+
+// Start gathering length bytes of res->text from every rank, in rank
+// order, straight into the batch's output buffer (rank 0 only). Rank 0
+// then writes the whole batch with one fwrite, nothing is reformatted.
+void results_gather_text(mpi_results *res, size_t length, line_batch *root_batch, MPI_Comm comm);
+
+// Wait for the gather started on res, if any
+void results_wait(mpi_results *res);
+
+#endif
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "out_writer.h"
+#include "trace.h"
+
+const results_schema *out_binary = NULL;
+
+// "00" to "99", two digits per lookup
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the decimal digits of n at out, returns how many
+static size_t format_unsigned(char *out, unsigned long n)
+{
+    char temp[20];
+    char *p = temp + sizeof(temp);
+
+    while (n >= 100)
+    {
+        unsigned long pair = (n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (n >= 10)
+    {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    }
+    else
+    {
+        *--p = '0' + n;
+    }
+
+    size_t length = temp + sizeof(temp) - p;
+    memcpy(out, p, length);
+    return length;
+}
+
+// Writes value in decimal at out, returns how many bytes
+static size_t format_int(char *out, int value)
+{
+    if (value < 0)
+    {
+        out[0] = '-';
+        return 1 + format_unsigned(out + 1, -(unsigned long)(long)value);
+    }
+
+    return format_unsigned(out, value);
+}
+
+// FORMAT LINE
+// Same bytes as printf("%ld: %d\n", line, value)
+size_t format_line(char *out, long line, int value)
+{
+    size_t length = 0;
+
+    if (line < 0)
+    {
+        out[length++] = '-';
+        length += format_unsigned(out + length, -(unsigned long)line);
+    }
+    else
+    {
+        length += format_unsigned(out + length, line);
+    }
+
+    out[length++] = ':';
+    out[length++] = ' ';
+    length += format_int(out + length, value);
+
+    out[length++] = '\n';
+    return length;
+}
+
+// FORMAT LINE MAX
+size_t format_line_max(void)
+{
+    if (out_binary != NULL)
+        return out_binary->record_size;
+    return FORMAT_LINE_MAX + (batch_value_fields - 1) * FORMAT_VALUE_MAX;
+}
+
+// FORMAT LINES
+size_t format_lines(char *out, long first_line, const int *values, long lines)
+{
+    size_t length = 0;
+    int fields = batch_value_fields;
+
+    // Line numbers are implied by the position of the record
+    if (out_binary != NULL)
+        return results_pack(out_binary, out, values, lines);
+
+    if (fields == 1)
+    {
+        for (long i = 0; i < lines; i++)
+        {
+            length += format_line(out + length, first_line + i, values[i]);
+        }
+        return length;
+    }
+
+    // --stats: the first value goes through format_line, the rest go before its newline
+    for (long i = 0; i < lines; i++)
+    {
+        const int *line_values = values + i * fields;
+
+        length += format_line(out + length, first_line + i, line_values[0]) - 1;
+        for (int f = 1; f < fields; f++)
+        {
+            out[length++] = ' ';
+            length += format_int(out + length, line_values[f]);
+        }
+        out[length++] = '\n';
+    }
+
+    return length;
+}
+
+// BATCH OUTPUT RESERVE
+int batch_output_reserve(line_batch *batch, int parts)
+{
+    size_t capacity = batch->lines * format_line_max();
+
+    if (capacity > batch->output_capacity)
+    {
+        char *temp = realloc(batch->output, capacity);
+        if (temp == NULL)
+            return -1;
+        batch->output = temp;
+        batch->output_capacity = capacity;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    if (parts > batch->output_part_count)
+    {
+        struct iovec *temp = realloc(batch->output_parts, parts * sizeof(struct iovec));
+        if (temp == NULL)
+            return -1;
+        batch->output_parts = temp;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    batch->output_part_count = parts;
+    batch->output_length = 0;
+    return 0;
+}
+
+// FORMAT BATCH RANGE
+// The region of lines [start, end) starts at start times format_line_max,
+// so ranges that do not overlap never share bytes of output
+void format_batch_range(line_batch *batch, int part, long start, long end)
+{
+    char *out = batch->output + start * format_line_max();
+
+    batch->output_parts[part].iov_base = out;
+    batch->output_parts[part].iov_len = format_lines(out, batch->offset + start,
+                                                     batch->max_values + start * batch_value_fields, end - start);
+}
+
+// FORMAT BATCH PART
+void format_batch_part(line_batch *batch, int part, int parts)
+{
+    long start, end;
+    batch_part(batch->lines, part, parts, &start, &end);
+    format_batch_range(batch, part, start, end);
+}
+
+// WRITE BATCH OUTPUT
+// writev may stop part way through, so keep going from where it stopped
+int write_batch_output(line_batch *batch, int fd)
+{
+    struct iovec single = {batch->output, batch->output_length};
+    struct iovec *parts = batch->output_part_count > 0 ? batch->output_parts : &single;
+    int count = batch->output_part_count > 0 ? batch->output_part_count : 1;
+
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, parts, count < IOV_MAX ? count : IOV_MAX);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // Skip the parts that went out completely, trim the one that did not
+        while (count > 0 && (size_t)written >= parts->iov_len)
+        {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = (char *)parts->iov_base + written;
+            parts->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef OUT_WRITER_H
+#define OUT_WRITER_H
+
+#include <stddef.h>
+
+#include "batch.h"
+#include "results_file.h"
+
+// OUTPUT WRITER
+// Replaces the printf per line. The workers render their own share of a
+// batch into a region of batch->output with a small integer formatter,
+// then the writer stage hands all regions to the kernel with one writev.
+
+#define FORMAT_LINE_MAX 34 // Longest "line_number: value\n": 19 + 2 + 11 characters and a newline
+#define FORMAT_VALUE_MAX 12 // Longest " value" after the first (--stats)
+
+// Record layout of --output=binary, NULL for text. Set it once before any
+// batch is rendered; format_lines then packs records instead of text.
+extern const results_schema *out_binary;
+
+// Formats "line: value\n" at out, returns the number of bytes written
+size_t format_line(char *out, long line, int value);
+
+// Longest line format_lines writes: FORMAT_LINE_MAX, plus FORMAT_VALUE_MAX
+// for every result after the first, or the record size with out_binary
+size_t format_line_max(void);
+
+// Formats lines results starting at line number first_line, each line
+// "line: value value ...\n" with batch_value_fields values from values
+size_t format_lines(char *out, long first_line, const int *values, long lines);
+
+// Makes room for format_line_max bytes per line and parts regions.
+// Call on one thread before the workers render. Returns 0, or -1 when out of memory.
+int batch_output_reserve(line_batch *batch, int parts);
+
+// Renders lines [start, end) into their own region of batch->output as
+// part number part. Parts must cover the batch in order without overlapping,
+// they are independent, so every worker renders the lines it computed.
+void format_batch_range(line_batch *batch, int part, long start, long end);
+
+// format_batch_range for part of parts, with the lines batch_part gives it
+void format_batch_part(line_batch *batch, int part, int parts);
+
+// Writes the rendered parts in order with writev (or output_length bytes of
+// output when there are no parts). Returns 0, or -1 with errno set.
+int write_batch_output(line_batch *batch, int fd);
+
+#endif
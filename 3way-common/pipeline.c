@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "trace.h"
+
+// Batches waiting for the next stage
+// At most depth batches exist, so a queue of depth slots never overflows
+typedef struct
+{
+    line_batch **items;
+    int capacity;
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+} batch_queue;
+
+// Everything the stage threads share
+typedef struct
+{
+    batch_queue free_q;    // Empty batches for the reader
+    batch_queue compute_q; // Read batches for compute
+    batch_queue write_q;   // Computed batches for the writer
+    read_stage_fn read_stage;
+    batch_stage_fn write_stage;
+    long first_line; // Line number of the first batch
+    atomic_int stop; // Set when the run is abandoned: the reader ends the input at its next batch
+    pipeline_stats *stats;
+} pipeline;
+
+// Seconds on the monotonic clock
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+// Returns 0, or -1 with nothing left to destroy
+static int queue_init(batch_queue *q, int capacity)
+{
+    q->items = malloc(capacity * sizeof(line_batch *));
+    if (q->items == NULL)
+        return -1;
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    return 0;
+}
+
+static void queue_destroy(batch_queue *q)
+{
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+static void queue_push(batch_queue *q, line_batch *batch)
+{
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count) % q->capacity] = batch;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Blocks until a batch is available, adding the time spent waiting to *wait
+static line_batch *queue_pop(batch_queue *q, double *wait)
+{
+    double start = now();
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+    {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    line_batch *batch = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+
+    *wait += now() - start;
+    return batch;
+}
+
+// READER THREAD
+// Fills empty batches until the input runs out, then passes on an empty
+// batch so the other stages know to stop
+static void *reader_thread(void *arg)
+{
+    pipeline *pl = arg;
+    long offset = pl->first_line;
+
+    trace_thread("reader", -1);
+
+    while (1)
+    {
+        line_batch *batch = queue_pop(&pl->free_q, &pl->stats->read_wait);
+
+        if (atomic_load(&pl->stop))
+        {
+            batch->lines = 0;
+            queue_push(&pl->compute_q, batch);
+            break;
+        }
+
+        double start = now();
+        double traced = trace_begin();
+        arena_reset(&batch->arena);
+        batch->offset = offset;
+        long lines = pl->read_stage(batch);
+        batch->lines = lines;
+        batch->read_time = now() - start;
+        pl->stats->read_busy += batch->read_time;
+
+        if (lines > 0)
+        {
+            trace_end(PHASE_READ, traced);
+            trace_count(COUNTER_LINES, lines);
+            trace_count(COUNTER_BYTES, batch->line_offsets[lines]);
+            trace_count(COUNTER_BATCHES, 1);
+        }
+
+        offset += lines;
+        queue_push(&pl->compute_q, batch);
+
+        if (lines == 0)
+            break;
+    }
+
+    return NULL;
+}
+
+// WRITER THREAD
+// Writes computed batches in order and hands them back to the reader
+static void *writer_thread(void *arg)
+{
+    pipeline *pl = arg;
+
+    trace_thread("writer", -1);
+
+    while (1)
+    {
+        line_batch *batch = queue_pop(&pl->write_q, &pl->stats->write_wait);
+        if (batch->lines == 0)
+            break;
+
+        double start = now();
+        double traced = trace_begin();
+        pl->write_stage(batch);
+        trace_end(PHASE_WRITE, traced);
+        pl->stats->write_busy += now() - start;
+        pl->stats->batches++;
+
+        queue_push(&pl->free_q, batch);
+    }
+
+    return NULL;
+}
+
+// PIPELINE RUN
+int pipeline_run(int depth, long capacity, long first_line, read_stage_fn read_stage, batch_stage_fn compute_stage,
+                 batch_stage_fn complete_stage, batch_stage_fn write_stage, pipeline_stats *stats)
+{
+    pipeline pl;
+    batch_queue *queues[] = {&pl.free_q, &pl.compute_q, &pl.write_q};
+    pthread_t reader, writer;
+    line_batch *pending = NULL; // Computed but not yet completed (complete_stage only)
+    int status = 0;
+    int error = 0; // From pthread_create, errno once cleaned up
+
+    if (depth < 1)
+        depth = 1;
+    if (complete_stage != NULL && depth < 2)
+        depth = 2;
+
+    memset(stats, 0, sizeof(*stats));
+    pl.read_stage = read_stage;
+    pl.first_line = first_line;
+    pl.write_stage = write_stage;
+    atomic_init(&pl.stop, 0);
+    pl.stats = stats;
+
+    line_batch *batches = calloc(depth, sizeof(line_batch));
+    int ready = 0;
+    while (batches != NULL && ready < 3 && queue_init(queues[ready], depth) == 0)
+        ready++;
+    if (ready < 3)
+    {
+        while (ready > 0)
+            queue_destroy(queues[--ready]);
+        free(batches);
+        return -1;
+    }
+
+    // Every batch is allocated once and reused for the whole run
+    for (int i = 0; i < depth; i++)
+    {
+        batches[i].line_offsets = malloc((capacity + 1) * sizeof(uint32_t));
+        batches[i].max_values = batch_values_alloc(capacity);
+        arena_init(&batches[i].arena, ARENA_INITIAL_SIZE);
+        if (batches[i].line_offsets == NULL || batches[i].max_values == NULL)
+        {
+            status = -1;
+            goto cleanup;
+        }
+        queue_push(&pl.free_q, &batches[i]);
+    }
+
+    if ((error = pthread_create(&reader, NULL, reader_thread, &pl)) != 0)
+    {
+        status = -1;
+        goto cleanup;
+    }
+    if ((error = pthread_create(&writer, NULL, writer_thread, &pl)) != 0)
+    {
+        // Stand in for the writer, handing every batch back unwritten
+        // until the reader sees the stop and ends the input
+        atomic_store(&pl.stop, 1);
+        line_batch *batch;
+        while ((batch = queue_pop(&pl.compute_q, &stats->compute_wait))->lines > 0)
+            queue_push(&pl.free_q, batch);
+        pthread_join(reader, NULL);
+        status = -1;
+        goto cleanup;
+    }
+
+    // Compute stage on this thread
+    while (1)
+    {
+        line_batch *batch = queue_pop(&pl.compute_q, &stats->compute_wait);
+
+        // Once pushed on, the batch can be written and refilled by the
+        // reader before this thread looks at it again
+        long lines = batch->lines;
+        double start = now();
+
+        if (lines > 0)
+        {
+            compute_stage(batch);
+            batch->compute_time = now() - start;
+        }
+
+        // Finish the previous batch now that this one is under way
+        if (pending != NULL)
+        {
+            complete_stage(pending);
+            queue_push(&pl.write_q, pending);
+            pending = NULL;
+        }
+
+        stats->compute_busy += now() - start;
+
+        if (complete_stage != NULL && lines > 0)
+            pending = batch;
+        else
+            queue_push(&pl.write_q, batch);
+
+        if (lines == 0)
+            break;
+    }
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+cleanup:
+    for (int i = 0; i < depth; i++)
+    {
+        if (batches[i].arena.high_water > stats->arena_high_water)
+            stats->arena_high_water = batches[i].arena.high_water;
+        if (batches[i].arena.base != NULL)
+            stats->arena_reserved += batches[i].arena.capacity;
+
+        arena_free(&batches[i].arena);
+        free(batches[i].line_offsets);
+        free(batches[i].max_values);
+        free(batches[i].output);
+        free(batches[i].output_parts);
+    }
+    free(batches);
+    for (int q = 0; q < 3; q++)
+        queue_destroy(queues[q]);
+    if (error != 0)
+        errno = error;
+    return status;
+}
+
+// PIPELINE REPORT
+// Busy time is work done by the stage, wait time is time it sat blocked on
+// its input queue. The run is bound by the stage with the most busy time.
+// The arena numbers are the memory the line copies really needed.
+void pipeline_report(FILE *fp, const pipeline_stats *stats)
+{
+    fprintf(fp, "\nRead: %.6fs (wait %.6fs) Compute: %.6fs (wait %.6fs) Write: %.6fs (wait %.6fs) Batches: %ld",
+            stats->read_busy, stats->read_wait, stats->compute_busy, stats->compute_wait, stats->write_busy,
+            stats->write_wait, stats->batches);
+    fprintf(fp, " Arena: %zu bytes peak per batch, %zu reserved", stats->arena_high_water, stats->arena_reserved);
+}
@@ -0,0 +1,52 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+
+#include "batch.h"
+
+#define DEFAULT_PIPELINE_DEPTH 3 // Triple buffering: read N+1, compute N, write N-1
+
+// PIPELINE
+// Runs reading, computing and writing as three overlapping stages.
+// The reader and writer get their own threads, compute runs on the
+// calling thread (so MPI calls stay on the main thread). depth batches
+// circulate between the stages; depth 1 is the old sequential loop.
+
+// Busy and blocked time of each stage, in seconds
+typedef struct
+{
+    double read_busy, compute_busy, write_busy;
+    double read_wait, compute_wait, write_wait;
+    long batches; // Batches that went through all three stages
+    size_t arena_high_water; // Most line bytes one batch ever held
+    size_t arena_reserved;   // Bytes the batch arenas hold from malloc, all batches together
+} pipeline_stats;
+
+// Stage callbacks
+// read_stage fills batch (offset is already set) and returns how many lines it read, 0 at the end of the input.
+// Until it does, the batch keeps the lines and stage times of its last fill (see batch_sizer_next).
+// compute_stage fills in the results of the batch
+// complete_stage (optional) finishes a batch compute_stage only started, see below
+// write_stage prints the results and frees whatever read_stage allocated outside the batch arena
+typedef long (*read_stage_fn)(line_batch *batch);
+typedef void (*batch_stage_fn)(line_batch *batch);
+
+// Run the pipeline until read_stage returns 0, every batch holds up to
+// capacity lines and the first one starts at line number first_line. Each
+// batch's arena is reset right before read_stage refills it, so lines
+// allocated there need no freeing. Returns 0, or -1 with errno set if the
+// batches could not be allocated or a stage thread could not be started.
+//
+// With a complete_stage the compute thread holds on to each batch until
+// the next one is computed: compute_stage(N) runs, then complete_stage(N-1),
+// then N-1 goes to the writer. This lets compute_stage start non-blocking
+// work (an MPI_Igatherv) that overlaps with the next batch. It needs at
+// least two batches, depth is raised to 2 if needed.
+int pipeline_run(int depth, long capacity, long first_line, read_stage_fn read_stage, batch_stage_fn compute_stage,
+                 batch_stage_fn complete_stage, batch_stage_fn write_stage, pipeline_stats *stats);
+
+// Write the per-stage times after the totals in the times file
+void pipeline_report(FILE *fp, const pipeline_stats *stats);
+
+#endif
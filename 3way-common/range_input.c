@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "range_input.h"
+#include "trace.h"
+
+// Start of the first line at or after offset: one past the first newline
+// at or after offset - 1. Returns file_size if there is none.
+static int line_start_at(int fd, off_t file_size, off_t offset, off_t *line_start)
+{
+    char block[4096];
+
+    if (offset <= 0)
+    {
+        *line_start = 0;
+        return 0;
+    }
+
+    for (off_t pos = offset - 1; pos < file_size;)
+    {
+        ssize_t got = pread(fd, block, sizeof(block), pos);
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+
+        char *nl = memchr(block, '\n', got);
+        if (nl != NULL)
+        {
+            *line_start = pos + (nl - block) + 1;
+            return 0;
+        }
+        pos += got;
+    }
+
+    *line_start = file_size;
+    return 0;
+}
+
+// RANGE FOR RANK
+// Both ends go through line_start_at, so the end of one rank is exactly
+// the start of the next
+int range_for_rank(int fd, off_t file_size, int rank, int size, off_t *start, off_t *end)
+{
+    off_t nominal_start = file_size / size * rank;
+    off_t nominal_end = (rank == size - 1) ? file_size : file_size / size * (rank + 1);
+
+    if (line_start_at(fd, file_size, nominal_start, start) != 0)
+        return -1;
+
+    if (rank == size - 1)
+    {
+        *end = file_size;
+        return 0;
+    }
+
+    return line_start_at(fd, file_size, nominal_end, end);
+}
+
+// RANGE READER OPEN
+int range_reader_open(range_reader *reader, int fd, off_t start, off_t end, size_t block_size)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->pos = start;
+    reader->end = end;
+    reader->capacity = block_size;
+    reader->buf = malloc(block_size);
+
+    return reader->buf == NULL ? -1 : 0;
+}
+
+// Moves the unreturned tail to the front of the buffer and reads more,
+// doubling the buffer when a single line does not fit. Returns bytes read.
+static ssize_t refill(range_reader *reader)
+{
+    size_t left = reader->length - reader->consumed;
+
+    memmove(reader->buf, reader->buf + reader->consumed, left);
+    reader->length = left;
+    reader->consumed = 0;
+
+    if (reader->length == reader->capacity)
+    {
+        char *temp = realloc(reader->buf, reader->capacity * 2);
+        if (temp == NULL)
+            return -1;
+        reader->buf = temp;
+        reader->capacity *= 2;
+        trace_count(COUNTER_ALLOCATIONS, 1);
+    }
+
+    size_t want = reader->capacity - reader->length;
+    if ((off_t)want > reader->end - reader->pos)
+        want = reader->end - reader->pos;
+    if (want == 0)
+        return 0;
+
+    ssize_t got;
+    do
+    {
+        got = pread(reader->fd, reader->buf + reader->length, want, reader->pos);
+    } while (got < 0 && errno == EINTR);
+
+    if (got > 0)
+    {
+        reader->length += got;
+        reader->pos += got;
+    }
+
+    return got;
+}
+
+// RANGE READER NEXT
+long range_reader_next(range_reader *reader, uint32_t *offsets, long max_lines)
+{
+    long lines_read = 0;
+
+    // Nothing returned last time may be overwritten before the caller is done,
+    // so the buffer is only refilled at the start of a call
+    if (reader->length - reader->consumed == 0 || memchr(reader->buf + reader->consumed, '\n',
+                                                         reader->length - reader->consumed) == NULL)
+    {
+        // Read until there is a full line or the range is used up
+        while (1)
+        {
+            ssize_t got = refill(reader);
+            if (got < 0)
+                return -1;
+            if (got == 0 || memchr(reader->buf, '\n', reader->length) != NULL)
+                break;
+        }
+    }
+
+    offsets[0] = reader->consumed;
+
+    while (lines_read < max_lines && reader->consumed < reader->length)
+    {
+        char *start = reader->buf + reader->consumed;
+        size_t left = reader->length - reader->consumed;
+        const char *nl = memchr(start, '\n', left);
+
+        // A line without its newline is only complete at the end of the range
+        if (nl == NULL && reader->pos < reader->end)
+            break;
+
+        size_t length = (nl == NULL) ? left : (size_t)(nl - start) + 1;
+
+        // Anything after an embedded NUL reads as 0, as with getline
+        char *nul = memchr(start, '\0', length);
+        if (nul != NULL)
+            memset(nul, 0, start + length - nul);
+
+        reader->consumed += length;
+        lines_read++;
+        offsets[lines_read] = reader->consumed;
+    }
+
+    return lines_read;
+}
+
+// RANGE READER CLOSE
+void range_reader_close(range_reader *reader)
+{
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,37 @@
+#ifndef RANGE_INPUT_H
+#define RANGE_INPUT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// RANGE INPUT
+// Lets every rank read its own slice of the dump with pread. The file is
+// cut into size roughly equal byte ranges and every cut is moved forward
+// to the start of the next line, so each line belongs to exactly one rank.
+
+// Reader for the lines of one byte range
+typedef struct
+{
+    int fd;
+    off_t pos;       // Next byte to pread
+    off_t end;       // End of the range
+    char *buf;       // Block buffer, lines are returned as offsets into it
+    size_t capacity;
+    size_t length;   // Valid bytes in buf
+    size_t consumed; // Bytes of buf already returned as lines
+} range_reader;
+
+// Byte range [start, end) of the file that rank owns. Returns 0, or -1 with errno set.
+int range_for_rank(int fd, off_t file_size, int rank, int size, off_t *start, off_t *end);
+
+// Start reading [start, end) in blocks of block_size bytes (grown for longer lines)
+int range_reader_open(range_reader *reader, int fd, off_t start, off_t end, size_t block_size);
+
+// Returns up to max_lines complete lines as lines + 1 offsets into
+// reader->buf (line i runs from offsets[i] to offsets[i + 1]). They stay
+// valid until the next call. Returns 0 at the end of the range, -1 on a read error.
+long range_reader_next(range_reader *reader, uint32_t *offsets, long max_lines);
+
+void range_reader_close(range_reader *reader);
+
+#endif
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "out_writer.h"
+#include "result_cache.h"
+
+#define REPLAY_LINES 65536 // Cached lines rendered per write when stdout does not hold them
+
+// Primes of the xxHash64 scheme
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+// Seconds on the monotonic clock
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+static uint64_t hash_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    return h ^ (h >> 32);
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// BLOCK HASH
+// 64-bit hash of a block: four independent multiply-rotate lanes over 32
+// bytes at a time, so it runs at several GB/s (the xxHash64 scheme)
+static uint64_t block_hash(const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = PRIME1 + PRIME2, v2 = PRIME2, v3 = 0, v4 = -PRIME1;
+        do
+        {
+            v1 = hash_round(v1, load64(p));
+            v2 = hash_round(v2, load64(p + 8));
+            v3 = hash_round(v3, load64(p + 16));
+            v4 = hash_round(v4, load64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        uint64_t lanes[4] = {v1, v2, v3, v4};
+        for (int l = 0; l < 4; l++)
+            h = (h ^ hash_round(0, lanes[l])) * PRIME1 + PRIME4;
+    }
+    else
+        h = PRIME5;
+
+    h += size;
+    for (; end - p >= 8; p += 8)
+        h = rotl(h ^ hash_round(0, load64(p)), 27) * PRIME1 + PRIME4;
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+
+    return hash_avalanche(h);
+}
+
+// FINGERPRINT
+// Rolling hash of the dump size and the hashes of its blocks in order
+static uint64_t fingerprint(uint64_t file_size, const cache_block *blocks, long count)
+{
+    uint64_t f = hash_round(PRIME5, file_size);
+    for (long b = 0; b < count; b++)
+        f = rotl(f ^ hash_round(0, blocks[b].hash), 27) * PRIME1 + PRIME4;
+    return hash_avalanche(f);
+}
+
+static int pread_all(int fd, void *buffer, size_t size, off_t offset)
+{
+    char *p = buffer;
+    while (size > 0)
+    {
+        ssize_t got = pread(fd, p, size, offset);
+        if (got <= 0)
+        {
+            if (got == 0)
+                errno = EINVAL;
+            if (got == 0 || errno != EINTR)
+                return -1;
+            continue;
+        }
+        p += got;
+        offset += got;
+        size -= got;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buffer, size_t size)
+{
+    const char *p = buffer;
+    while (size > 0)
+    {
+        ssize_t put = write(fd, p, size);
+        if (put < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += put;
+        size -= put;
+    }
+    return 0;
+}
+
+// Where the next write to fd lands, -1 when fd is -1 or cannot seek. With
+// O_APPEND (stdout after >>) that is the end of the file, whatever the
+// offset was before the first write.
+static int64_t output_position(int fd)
+{
+    if (fd < 0)
+        return -1;
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return -1;
+    return lseek(fd, 0, flags & O_APPEND ? SEEK_END : SEEK_CUR);
+}
+
+// File offset of the results of line line
+static off_t values_offset(uint64_t line, uint32_t fields)
+{
+    return sizeof(result_cache_header) + line * fields * sizeof(int32_t);
+}
+
+// Read the cache at cache->path into cache->old and cache->blocks.
+// Returns NULL when it can be used, otherwise why not.
+static const char *load_cache(result_cache *cache, const run_config *config)
+{
+    result_cache_header *old = &cache->old;
+
+    cache->old_fd = open(cache->path, O_RDONLY);
+    if (cache->old_fd < 0)
+        return errno == ENOENT ? "none yet" : "cannot be read";
+
+    if (pread_all(cache->old_fd, old, sizeof(*old), 0) != 0 ||
+        memcmp(old->magic, RESULT_CACHE_MAGIC, sizeof(old->magic)) != 0 || old->version != RESULT_CACHE_VERSION)
+        return "not a cache";
+    if (old->value_fields != (uint32_t)batch_value_fields || old->stats != config->stats)
+        return "results of other --stats";
+
+    cache->blocks = malloc((old->blocks > 0 ? old->blocks : 1) * sizeof(cache_block));
+    if (cache->blocks == NULL)
+        return "out of memory";
+    cache->block_capacity = old->blocks > 0 ? old->blocks : 1;
+
+    if (pread_all(cache->old_fd, cache->blocks, old->blocks * sizeof(cache_block),
+                  values_offset(old->lines, old->value_fields)) != 0)
+        return "damaged";
+
+    // The blocks follow each other from line 0 at byte 0
+    uint64_t bytes = 0, lines = 0;
+    for (uint64_t b = 0; b < old->blocks; b++)
+    {
+        if (cache->blocks[b].offset != bytes || cache->blocks[b].first_line != lines)
+            return "damaged";
+        bytes += cache->blocks[b].bytes;
+        lines += cache->blocks[b].lines;
+    }
+    if (bytes != old->file_size || lines != old->lines ||
+        fingerprint(old->file_size, cache->blocks, old->blocks) != old->fingerprint)
+        return "damaged";
+
+    return NULL;
+}
+
+// Blocks of the cache checked against the dump by several threads
+typedef struct
+{
+    const char *data;
+    size_t size;
+    const cache_block *blocks;
+    atomic_long next;          // Next block to claim
+    atomic_long first_changed; // Lowest block found changed so far
+    atomic_long verified;
+} verify_job;
+
+// VERIFY WORKER
+// Claims blocks in order and hashes them again. Once a changed block is
+// found nothing after it can be reused, so the threads stop there. A block
+// that does not end in a newline ended with the dump's unfinished last
+// line: bytes appended since go on that line, so it counts as changed even
+// when its own bytes still match.
+static void *verify_worker(void *arg)
+{
+    verify_job *job = arg;
+    long b;
+
+    while ((b = atomic_fetch_add(&job->next, 1)) < atomic_load(&job->first_changed))
+    {
+        const cache_block *block = &job->blocks[b];
+        atomic_fetch_add(&job->verified, 1);
+
+        if (block->bytes > 0 && block->offset + block->bytes <= job->size &&
+            job->data[block->offset + block->bytes - 1] == '\n' &&
+            block_hash(job->data + block->offset, block->bytes) == block->hash)
+            continue;
+
+        long seen = atomic_load(&job->first_changed);
+        while (b < seen && !atomic_compare_exchange_weak(&job->first_changed, &seen, b))
+            ;
+    }
+
+    return NULL;
+}
+
+// How many of the first count blocks of the cache the dump at input_path still has
+static long verify_blocks(result_cache *cache, const char *input_path, long count, int threads)
+{
+    struct stat st;
+    verify_job job;
+
+    if (count == 0)
+        return 0;
+
+    int fd = open(input_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    job.data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (job.data == MAP_FAILED)
+        return -1;
+    madvise((void *)job.data, st.st_size, MADV_SEQUENTIAL);
+
+    job.size = st.st_size;
+    job.blocks = cache->blocks;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.first_changed, count);
+    atomic_init(&job.verified, 0);
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > count)
+        threads = count;
+
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    if (ids != NULL)
+    {
+        for (; started < threads; started++)
+            if (pthread_create(&ids[started], NULL, verify_worker, &job) != 0)
+                break;
+    }
+
+    // The calling thread hashes too, and does it all when no thread started
+    verify_worker(&job);
+    for (int t = 0; t < started; t++)
+        pthread_join(ids[t], NULL);
+    free(ids);
+
+    munmap((void *)job.data, job.size);
+    cache->verified_blocks = atomic_load(&job.verified);
+    return atomic_load(&job.first_changed);
+}
+
+// Copy the results of the reused lines from the old cache to the new one
+static int copy_values(result_cache *cache)
+{
+    char buffer[65536];
+    off_t from = values_offset(0, cache->old.value_fields);
+    size_t left = cache->reused_lines * cache->old.value_fields * sizeof(int32_t);
+
+    while (left > 0)
+    {
+        size_t size = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (pread_all(cache->old_fd, buffer, size, from) != 0 || write_all(cache->fd, buffer, size) != 0)
+            return -1;
+        from += size;
+        left -= size;
+    }
+    return 0;
+}
+
+// Cut output_fd back to the end of the reused results when it holds the
+// output of the cached run, as appended to with >>. Whatever was there
+// before that run's output is never cut.
+static int continue_output(result_cache *cache, const run_config *config, int output_fd)
+{
+    struct stat st;
+
+    if (output_fd < 0 || cache->unused != NULL || fstat(output_fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    int64_t cut = (uint64_t)cache->reused_blocks < cache->old.blocks ? cache->blocks[cache->reused_blocks].output_offset
+                                                                      : cache->old.output_end;
+    if (cache->old.output != (uint32_t)config->output || cache->old.output_end < 0 ||
+        st.st_size != cache->old.output_end || cache->old.output_start < 0 || cut < cache->old.output_start)
+    {
+        if (st.st_size > 0)
+            fprintf(stderr, "Warning: stdout does not end with the output of the cached run, "
+                            "its results are written again after what it holds\n");
+        return 0;
+    }
+
+    if (ftruncate(output_fd, cut) != 0 || lseek(output_fd, cut, SEEK_SET) < 0)
+        return -1;
+    cache->continued = 1;
+    return 0;
+}
+
+// RESULT CACHE OPEN
+int result_cache_open(result_cache *cache, run_config *config, int output_fd, uint64_t *offset)
+{
+    char temp[4096];
+
+    memset(cache, 0, sizeof(*cache));
+    cache->path = config->cache_path;
+    cache->old_fd = -1;
+    cache->fd = -1;
+    cache->input_fd = -1;
+
+    if (cache->path == NULL)
+        return 0;
+    *offset = 0;
+
+    cache->input_fd = open(config->input_path, O_RDONLY);
+    if (cache->input_fd < 0)
+        return -1;
+
+    double start = now();
+    cache->unused = load_cache(cache, config);
+    if (cache->unused == NULL)
+    {
+        // Only whole blocks within --lines can be reused
+        long usable = 0;
+        while ((uint64_t)usable < cache->old.blocks &&
+               cache->blocks[usable].first_line + cache->blocks[usable].lines <= (uint64_t)config->lines)
+            usable++;
+
+        cache->reused_blocks = verify_blocks(cache, config->input_path, usable, config->threads);
+        if (cache->reused_blocks < 0)
+            return -1;
+        for (long b = 0; b < cache->reused_blocks; b++)
+        {
+            cache->reused_lines += cache->blocks[b].lines;
+            *offset += cache->blocks[b].bytes;
+        }
+    }
+    cache->verify_seconds = now() - start;
+    cache->block_count = cache->reused_blocks;
+
+    if (snprintf(temp, sizeof(temp), "%s.tmp", cache->path) >= (int)sizeof(temp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    cache->fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (cache->fd < 0 || lseek(cache->fd, values_offset(0, batch_value_fields), SEEK_SET) < 0 ||
+        copy_values(cache) != 0 || continue_output(cache, config, output_fd) != 0)
+        return -1;
+
+    result_cache_header *header = &cache->header;
+    memcpy(header->magic, RESULT_CACHE_MAGIC, sizeof(header->magic));
+    header->version = RESULT_CACHE_VERSION;
+    header->value_fields = batch_value_fields;
+    header->stats = config->stats;
+    header->output = config->output;
+    header->lines = cache->reused_lines;
+    header->file_size = *offset;
+    header->output_start = cache->continued ? cache->old.output_start : output_position(output_fd);
+
+    // The run goes on after the reused lines
+    config->start = cache->reused_lines;
+    if (config->lines != LONG_MAX)
+        config->lines -= cache->reused_lines;
+    return 0;
+}
+
+// RESULT CACHE CONTINUES OUTPUT
+int result_cache_continues_output(const result_cache *cache)
+{
+    return cache->continued;
+}
+
+// RESULT CACHE OUTPUT START
+int64_t result_cache_output_start(const result_cache *cache)
+{
+    return cache->continued ? cache->old.output_start : -1;
+}
+
+// RESULT CACHE REPLAY
+int result_cache_replay(result_cache *cache, int output_fd)
+{
+    if (cache->path == NULL || cache->continued || output_fd < 0 || cache->reused_lines == 0)
+        return 0;
+
+    int fields = batch_value_fields;
+    int *values = malloc(REPLAY_LINES * fields * sizeof(int));
+    char *out = malloc(REPLAY_LINES * format_line_max());
+    int status = values != NULL && out != NULL ? 0 : -1;
+
+    for (uint64_t line = 0; status == 0 && line < cache->reused_lines; line += REPLAY_LINES)
+    {
+        long lines = cache->reused_lines - line < REPLAY_LINES ? cache->reused_lines - line : REPLAY_LINES;
+        if (pread_all(cache->old_fd, values, lines * fields * sizeof(int), values_offset(line, fields)) != 0 ||
+            write_all(output_fd, out, format_lines(out, line, values, lines)) != 0)
+            status = -1;
+    }
+
+    free(values);
+    free(out);
+    return status;
+}
+
+// The bytes of block as the dump has them. Those of a batch with an
+// embedded NUL are a copy with everything after it zeroed, the hash would
+// never match the dump again, so they are read back from the file.
+static const void *original_bytes(result_cache *cache, const line_batch *batch, const cache_block *block)
+{
+    if (!batch->zeroed)
+        return batch->bytes;
+
+    if (block->bytes > cache->original_size)
+    {
+        char *original = realloc(cache->original, block->bytes);
+        if (original == NULL)
+            return NULL;
+        cache->original = original;
+        cache->original_size = block->bytes;
+    }
+    if (pread_all(cache->input_fd, cache->original, block->bytes, block->offset) != 0)
+        return NULL;
+    return cache->original;
+}
+
+// RESULT CACHE RECORD
+int result_cache_record(result_cache *cache, const line_batch *batch, int output_fd)
+{
+    if (cache->path == NULL || batch->lines == 0)
+        return 0;
+
+    if (cache->block_count == cache->block_capacity)
+    {
+        long capacity = cache->block_capacity > 0 ? cache->block_capacity * 2 : 256;
+        cache_block *blocks = realloc(cache->blocks, capacity * sizeof(cache_block));
+        if (blocks == NULL)
+            return -1;
+        cache->blocks = blocks;
+        cache->block_capacity = capacity;
+    }
+
+    cache_block *block = &cache->blocks[cache->block_count];
+    block->offset = batch->file_offset;
+    block->bytes = batch->line_offsets[batch->lines];
+    block->first_line = batch->offset;
+    block->lines = batch->lines;
+    const void *bytes = original_bytes(cache, batch, block);
+    if (bytes == NULL)
+        return -1;
+    block->hash = block_hash(bytes, block->bytes);
+    block->output_offset = output_position(output_fd);
+
+    if (write_all(cache->fd, batch->max_values, batch->lines * batch_value_fields * sizeof(int)) != 0)
+        return -1;
+
+    cache->block_count++;
+    cache->header.lines += batch->lines;
+    cache->header.file_size = block->offset + block->bytes;
+    return 0;
+}
+
+// RESULT CACHE FINISH
+int result_cache_finish(result_cache *cache, int output_fd)
+{
+    char temp[4096];
+
+    if (cache->path == NULL)
+        return 0;
+
+    result_cache_header *header = &cache->header;
+    header->blocks = cache->block_count;
+    header->fingerprint = fingerprint(header->file_size, cache->blocks, cache->block_count);
+    header->output_end = output_position(output_fd);
+
+    if (snprintf(temp, sizeof(temp), "%s.tmp", cache->path) >= (int)sizeof(temp))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int status = write_all(cache->fd, cache->blocks, cache->block_count * sizeof(cache_block)) == 0 &&
+                         pwrite(cache->fd, header, sizeof(*header), 0) == sizeof(*header)
+                     ? 0
+                     : -1;
+    if (close(cache->fd) != 0)
+        status = -1;
+    cache->fd = -1;
+
+    if (status != 0 || rename(temp, cache->path) != 0)
+    {
+        unlink(temp);
+        return -1;
+    }
+    return 0;
+}
+
+// RESULT CACHE REPORT
+void result_cache_report(FILE *fp, const result_cache *cache)
+{
+    if (cache->path == NULL)
+        return;
+
+    fprintf(fp, "\nCache: %s", cache->path);
+    if (cache->unused != NULL)
+        fprintf(fp, " not used (%s)", cache->unused);
+    else
+        fprintf(fp, " reused %lu of %lu lines (%ld of %lu blocks, %ld hashed in %.6fs), output %s",
+                (unsigned long)cache->reused_lines, (unsigned long)cache->old.lines, cache->reused_blocks,
+                (unsigned long)cache->old.blocks, cache->verified_blocks, cache->verify_seconds,
+                cache->continued ? "continued" : "rendered again");
+    fprintf(fp, ", now %lu lines in %ld blocks", (unsigned long)cache->header.lines, cache->block_count);
+}
+
+// RESULT CACHE FREE
+void result_cache_free(result_cache *cache)
+{
+    free(cache->blocks);
+    cache->blocks = NULL;
+    if (cache->old_fd >= 0)
+        close(cache->old_fd);
+    cache->old_fd = -1;
+    if (cache->fd >= 0)
+        close(cache->fd);
+    cache->fd = -1;
+    if (cache->input_fd >= 0)
+        close(cache->input_fd);
+    cache->input_fd = -1;
+    free(cache->original);
+    cache->original = NULL;
+}
@@ -0,0 +1,114 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "config.h"
+
+// RESULT CACHE
+// The dump is refreshed by appending articles, and the results of lines
+// already there cannot change. With --cache=file every run keeps the
+// results of every line it computed, together with a fingerprint of the
+// dump: the byte range and a hash of every batch (a block) and a rolling
+// hash of those. The next run hashes the blocks again with every thread
+// (cheap next to the kernel, formatting and writing), reuses the results
+// of the blocks that still match up to the first one that does not, and
+// only reads and computes the dump from there on, appended lines included.
+//
+// When stdout is the output of the last run, appended to with >>, it is cut
+// back to the end of the reused blocks and the new results go after them,
+// so the run costs the hashing plus the new lines. Otherwise the reused
+// results are rendered from the cache, no kernel and no dump reads:
+//
+//     ./pthread-exc t.txt --lines=all --cache=dump.cache dump.txt > out.txt
+//     cat new_articles.txt >> dump.txt
+//     ./pthread-exc t.txt --lines=all --cache=dump.cache dump.txt >> out.txt
+//
+// The file, replaced with a rename at the end of the run:
+//
+//     result_cache_header
+//     int32_t x lines * value_fields    results of every line, as in max_values
+//     cache_block x blocks
+
+#define RESULT_CACHE_MAGIC "3WAYRCH1"
+#define RESULT_CACHE_VERSION 2 // 2 added output_start
+
+typedef struct
+{
+    char magic[8];          // RESULT_CACHE_MAGIC, no NUL
+    uint32_t version;       // RESULT_CACHE_VERSION
+    uint32_t value_fields;  // Results per line
+    uint32_t stats;         // --stats flags of the results, 0 for the max ASCII kernel
+    uint32_t output;        // output_mode of the run that wrote it
+    uint64_t file_size;     // Dump bytes the blocks cover
+    uint64_t lines;
+    uint64_t blocks;
+    uint64_t fingerprint;   // Rolling hash of file_size and every block hash
+    int64_t output_end;     // stdout length at the end of that run, -1 when unknown
+    int64_t output_start;   // stdout length before that run's output, never cut below; -1 when unknown
+} result_cache_header;
+
+typedef struct
+{
+    uint64_t offset;        // Byte offset in the dump
+    uint64_t bytes;
+    uint64_t first_line;
+    uint64_t lines;
+    uint64_t hash;          // Of the bytes
+    int64_t output_offset;  // stdout length before its results, -1 when unknown
+} cache_block;
+
+typedef struct
+{
+    const char *path;       // --cache, NULL for none
+    result_cache_header old; // Cache found at the start, all 0 when there was none
+    result_cache_header header; // The one this run writes
+    int old_fd;
+    const char *unused;     // Why the old cache could not be used at all, NULL when it could
+    cache_block *blocks;    // Blocks of the new cache: the reused ones, then the new ones
+    long block_count;
+    long block_capacity;
+    long reused_blocks;
+    uint64_t reused_lines;
+    long verified_blocks;   // Hashed again before a changed one was found
+    double verify_seconds;
+    int continued;          // stdout already held the reused results
+    int fd;                 // New cache, written to path + ".tmp"
+    int input_fd;           // The dump, for the bytes of a block read with its NULs zeroed
+    char *original;         // Those bytes as the dump has them
+    size_t original_size;
+} result_cache;
+
+// RESULT CACHE OPEN
+// Checks the cache at cache->path against the dump, keeps the results of
+// the unchanged blocks, and moves config->start and config->lines past
+// them. output_fd is cut back to the end of those results when it holds
+// the output of the cached run. *offset is the byte offset to read from.
+// Does nothing without --cache. Returns 0, or -1 with errno set.
+int result_cache_open(result_cache *cache, run_config *config, int output_fd, uint64_t *offset);
+
+// Whether stdout already holds the reused results, headers included
+int result_cache_continues_output(const result_cache *cache);
+
+// Offset in stdout of the headers of the output it continues, -1 when unknown
+int64_t result_cache_output_start(const result_cache *cache);
+
+// Render the reused results to output_fd when it does not hold them yet.
+// Call after the headers. Returns 0, or -1 with errno set.
+int result_cache_replay(result_cache *cache, int output_fd);
+
+// Add the block of a computed batch. Call on the writer before its results
+// go to output_fd (-1 when nothing is written). Returns 0, or -1 with errno set.
+int result_cache_record(result_cache *cache, const line_batch *batch, int output_fd);
+
+// Write the block table and header and put the new cache in place
+int result_cache_finish(result_cache *cache, int output_fd);
+
+// How much of the cache was reused, for the times file
+void result_cache_report(FILE *fp, const result_cache *cache);
+
+void result_cache_free(result_cache *cache);
+
+#endif
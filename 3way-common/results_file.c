@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "results_file.h"
+
+// Bytes before the first record: header, schema, padding to RESULTS_ALIGN
+#define DATA_OFFSET(fields) \
+    ((sizeof(results_header) + (fields) * sizeof(results_field) + RESULTS_ALIGN - 1) / RESULTS_ALIGN * RESULTS_ALIGN)
+
+static size_t data_offset(int fields)
+{
+    return DATA_OFFSET(fields);
+}
+
+// Add one column, byte values take one byte and counts four
+static void add_field(results_schema *schema, const char *name, size_t length)
+{
+    results_field *field = &schema->field[schema->fields++];
+
+    memset(field, 0, sizeof(*field));
+    memcpy(field->name, name, length < RESULTS_NAME_MAX ? length : RESULTS_NAME_MAX - 1);
+    field->width = strcmp(field->name, "max") == 0 || strcmp(field->name, "min") == 0 ? 1 : 4;
+    field->is_signed = strcmp(field->name, "max") == 0;
+    schema->record_size += field->width;
+}
+
+// RESULTS SCHEMA INIT
+// The column names come from the --stats schema line, so the two never disagree
+void results_schema_init(results_schema *schema, unsigned stats, const char *single_name)
+{
+    memset(schema, 0, sizeof(*schema));
+    schema->start = -1;
+
+    if (stats == 0)
+    {
+        add_field(schema, single_name, strlen(single_name));
+        return;
+    }
+
+    char names[STATS_SCHEMA_MAX];
+    line_stats_schema(names, stats);
+    schema->flags = RESULTS_STATS;
+
+    // "line: max min ...", one column per name after the colon
+    for (const char *p = strchr(names, ':') + 1; *p != '\0';)
+    {
+        p += strspn(p, " ");
+        size_t length = strcspn(p, " ");
+        if (length > 0)
+            add_field(schema, p, length);
+        p += length;
+    }
+}
+
+// RESULTS PACK
+// Counts are written byte by byte in little-endian order on any host
+size_t results_pack(const results_schema *schema, char *out, const int *values, long lines)
+{
+    unsigned char *p = (unsigned char *)out;
+    int fields = schema->fields;
+
+    // The default kernel has one byte per line, no loop over the schema
+    if (fields == 1 && schema->field[0].width == 1)
+    {
+        for (long i = 0; i < lines; i++)
+            p[i] = values[i];
+        return lines;
+    }
+
+    for (long i = 0; i < lines; i++)
+    {
+        for (int f = 0; f < fields; f++)
+        {
+            uint32_t value = values[i * fields + f];
+
+            *p++ = value;
+            if (schema->field[f].width == 4)
+            {
+                *p++ = value >> 8;
+                *p++ = value >> 16;
+                *p++ = value >> 24;
+            }
+        }
+    }
+
+    return (char *)p - out;
+}
+
+// Write all length bytes at buf
+static int write_all(int fd, const char *buf, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buf, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            return -1;
+        buf += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// RESULTS WRITE HEADER
+int results_write_header(int fd, results_schema *schema, long first_line)
+{
+    char block[DATA_OFFSET(STATS_FIELDS_MAX)] = {0};
+    // Every column a schema can hold must fit, whatever --stats adds next
+    _Static_assert(sizeof(((results_schema *)0)->field) / sizeof(results_field) <= STATS_FIELDS_MAX,
+                   "the header block is sized for STATS_FIELDS_MAX columns");
+    size_t offset = data_offset(schema->fields);
+    results_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULTS_MAGIC, sizeof(header.magic));
+    header.version = RESULTS_VERSION;
+    header.fields = schema->fields;
+    header.lines = RESULTS_LINES_UNKNOWN;
+    header.record_size = schema->record_size;
+    header.data_offset = offset;
+    header.flags = schema->flags;
+    header.first_line = first_line;
+
+    memcpy(block, &header, sizeof(header));
+    memcpy(block + sizeof(header), schema->field, schema->fields * sizeof(results_field));
+
+    if (write_all(fd, block, offset) != 0)
+        return -1;
+
+    // The header is where the write left off, minus itself: with O_APPEND
+    // (stdout after >>) that is the end of what was there, not the offset
+    // before the write. A pipe cannot seek and keeps the count unknown.
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    schema->start = end >= (off_t)offset ? end - (off_t)offset : -1;
+    return 0;
+}
+
+// RESULTS FINISH
+int results_finish(int fd, const results_schema *schema)
+{
+    if (schema->start < 0)
+        return 0;
+
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if (end < 0)
+        return -1;
+
+    uint64_t lines = (end - schema->start - data_offset(schema->fields)) / schema->record_size;
+    off_t at = schema->start + offsetof(results_header, lines);
+
+    // On Linux pwrite on an O_APPEND fd appends, and the flag belongs to the
+    // open file the shell shares with us, so the count goes in through a
+    // second open of the same file instead
+    int flags = fcntl(fd, F_GETFL);
+    int patch_fd = fd;
+    if (flags < 0)
+        return -1;
+    if (flags & O_APPEND)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        patch_fd = open(path, O_WRONLY);
+        if (patch_fd < 0)
+            return -1;
+    }
+
+    int status = pwrite(patch_fd, &lines, sizeof(lines), at) == sizeof(lines) ? 0 : -1;
+    if (patch_fd != fd)
+        close(patch_fd);
+    return status;
+}
+
+// RESULTS MAP OPEN
+int results_map_open(results_map *map, const char *path)
+{
+    struct stat st;
+
+    memset(map, 0, sizeof(*map));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)st.st_size < sizeof(results_header))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    map->data = data;
+    map->size = st.st_size;
+    map->header = data;
+    map->fields = (const results_field *)(map->data + sizeof(results_header));
+
+    // Everything the records are read with must be in the file and agree
+    const results_header *header = map->header;
+    uint32_t record_size = 0;
+    int valid = memcmp(header->magic, RESULTS_MAGIC, sizeof(header->magic)) == 0 &&
+                header->version == RESULTS_VERSION && header->fields > 0 && header->fields <= STATS_FIELDS_MAX &&
+                header->data_offset >= data_offset(header->fields) && header->data_offset <= map->size;
+
+    for (uint32_t f = 0; valid && f < header->fields; f++)
+    {
+        valid = map->fields[f].width == 1 || map->fields[f].width == 4;
+        map->offsets[f] = record_size;
+        record_size += map->fields[f].width;
+    }
+    valid = valid && record_size == header->record_size;
+
+    if (valid)
+    {
+        uint64_t records = (map->size - header->data_offset) / record_size;
+        map->lines = header->lines == RESULTS_LINES_UNKNOWN ? records : header->lines;
+        valid = map->lines <= records;
+    }
+
+    if (!valid)
+    {
+        results_map_close(map);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map->records = (const unsigned char *)map->data + header->data_offset;
+    return 0;
+}
+
+// RESULTS MAP VALUE
+int results_map_value(const results_map *map, uint64_t line, int field)
+{
+    const unsigned char *p = map->records + line * map->header->record_size + map->offsets[field];
+
+    if (map->fields[field].width == 1)
+        return map->fields[field].is_signed ? (signed char)p[0] : p[0];
+    return (int)(p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+// RESULTS MAP CLOSE
+void results_map_close(results_map *map)
+{
+    if (map->data != NULL)
+        munmap((void *)map->data, map->size);
+    memset(map, 0, sizeof(*map));
+}
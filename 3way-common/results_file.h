@@ -0,0 +1,102 @@
+#ifndef RESULTS_FILE_H
+#define RESULTS_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "line_stats.h"
+
+// RESULTS FILE
+// Binary output (--output=binary): instead of "line: value" text, stdout
+// gets a header, the schema of the columns and then one fixed-size record
+// per line, line numbers implied by the position:
+//
+//     results_header                 magic, line count, first line number, record size, ...
+//     results_field x fields         name and width (1 or 4 bytes) of every column
+//     padding to RESULTS_ALIGN
+//     record x lines                 the columns back to back, little-endian, no padding
+//
+// max and min (byte values) take 1 byte, the counts 4. Every batch is
+// packed by the threads that computed it and goes out with one write, and
+// a consumer can mmap the file and index it directly (results_map). When
+// stdout is a file the line count is filled in at the end; through a pipe
+// it stays RESULTS_LINES_UNKNOWN and readers count the records instead.
+// 3way-results/results-exc converts a file back to the text output.
+
+#define RESULTS_MAGIC "3WAYRES1"
+#define RESULTS_VERSION 2 // 2 added first_line
+#define RESULTS_ALIGN 64 // Records start on a cache line
+#define RESULTS_LINES_UNKNOWN UINT64_MAX
+#define RESULTS_NAME_MAX 16
+
+#define RESULTS_STATS 1 // Flag: --stats picked the columns, so the text has a "# line: ..." line first
+
+typedef struct
+{
+    char magic[8];        // RESULTS_MAGIC, no NUL
+    uint32_t version;     // RESULTS_VERSION
+    uint32_t fields;      // Columns per record
+    uint64_t lines;       // Records, or RESULTS_LINES_UNKNOWN
+    uint32_t record_size; // Bytes per record
+    uint32_t data_offset; // File offset of the first record
+    uint32_t flags;       // RESULTS_STATS
+    uint32_t reserved;
+    uint64_t first_line;  // Line number of the first record, --start or where a checkpoint went on
+} results_header;
+
+typedef struct
+{
+    char name[RESULTS_NAME_MAX]; // "max", "length", "alpha", ... NUL padded
+    uint32_t width;              // Bytes: 1 or 4
+    uint32_t is_signed;          // 1 for max, a signed byte as in max_byte
+} results_field;
+
+// Columns of the results of a run, in the order of the values of a line
+typedef struct
+{
+    int fields;
+    uint32_t flags;
+    results_field field[STATS_FIELDS_MAX];
+    size_t record_size;
+    off_t start; // Offset of the header in the output, -1 when it is not seekable
+} results_schema;
+
+// Schema for the --stats flags stats, or when 0 the one column name of the
+// single-value kernel ("max", or "letters" for --histogram)
+void results_schema_init(results_schema *schema, unsigned stats, const char *single_name);
+
+// Pack lines results of schema->fields values each into records at out.
+// Returns the bytes written, lines * record_size.
+size_t results_pack(const results_schema *schema, char *out, const int *values, long lines);
+
+// Write the header and schema to fd, the records numbered from first_line.
+// Returns 0, or -1 with errno set.
+int results_write_header(int fd, results_schema *schema, long first_line);
+
+// Fill in the line count now that every record is written, if fd can seek.
+// Returns 0, or -1 with errno set.
+int results_finish(int fd, const results_schema *schema);
+
+// A results file mapped read-only
+typedef struct
+{
+    const char *data;
+    size_t size;
+    const results_header *header;
+    const results_field *fields;
+    const unsigned char *records;
+    uint64_t lines; // From the header, or counted when it was left unknown
+    uint32_t offsets[STATS_FIELDS_MAX]; // Byte offset of every column in a record
+} results_map;
+
+// Map and check the file at path. Returns 0, or -1 with errno set (EINVAL
+// for a file that is not a results file).
+int results_map_open(results_map *map, const char *path);
+
+// Column field of line line
+int results_map_value(const results_map *map, uint64_t line, int field);
+
+void results_map_close(results_map *map);
+
+#endif
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "schedule.h"
+
+static const char *schedule_names[] = {"static", "bytes", "dynamic"};
+
+// SCHEDULE PARSE
+int schedule_parse(const char *name, schedule_kind *kind)
+{
+    for (int i = 0; i < (int)(sizeof(schedule_names) / sizeof(schedule_names[0])); i++)
+    {
+        if (strcmp(name, schedule_names[i]) == 0)
+        {
+            *kind = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *schedule_name(schedule_kind kind)
+{
+    return schedule_names[kind];
+}
+
+// First cache line boundary of max_values at or after byte target of the
+// batch, found by binary search over the (cumulative) line offsets
+static long boundary_at_byte(const line_batch *batch, uint64_t target)
+{
+    long low = 0;
+    long high = (batch->lines + VALUES_PER_CACHE_LINE - 1) / VALUES_PER_CACHE_LINE;
+
+    while (low < high)
+    {
+        long mid = (low + high) / 2;
+        long line = mid * VALUES_PER_CACHE_LINE < batch->lines ? mid * VALUES_PER_CACHE_LINE : batch->lines;
+
+        if (batch->line_offsets[line] >= target)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return low * VALUES_PER_CACHE_LINE < batch->lines ? low * VALUES_PER_CACHE_LINE : batch->lines;
+}
+
+// SCHEDULE PART
+void schedule_part(schedule_kind kind, const line_batch *batch, int part, int parts, long *start, long *end)
+{
+    if (kind != SCHEDULE_BYTES)
+    {
+        batch_part(batch->lines, part, parts, start, end);
+        return;
+    }
+
+    uint64_t total = batch->line_offsets[batch->lines];
+
+    *start = boundary_at_byte(batch, total * part / parts);
+    *end = (part == parts - 1) ? batch->lines : boundary_at_byte(batch, total * (part + 1) / parts);
+}
+
+// SCHEDULE PARTS
+int schedule_parts(schedule_kind kind, long lines, int threads)
+{
+    if (kind == SCHEDULE_DYNAMIC)
+        return (lines + VALUES_PER_CACHE_LINE - 1) / VALUES_PER_CACHE_LINE;
+
+    return threads;
+}
+
+// SCHEDULE REPORT
+// The gap between CPU% and elapsed time shows up here as idle time
+void schedule_report(FILE *fp, schedule_kind kind, const thread_stats *stats, int threads)
+{
+    fprintf(fp, "\nSchedule: %s", schedule_name(kind));
+
+    for (int t = 0; t < threads; t++)
+    {
+        fprintf(fp, " T%d: %.6fs busy %.6fs idle %ld lines", t, stats[t].busy, stats[t].idle, stats[t].lines);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdio.h>
+
+#include "batch.h"
+
+// SCHEDULE
+// How the lines of a batch are shared out between threads (--schedule=).
+// Line lengths in the dump range from a few bytes to hundreds of KB, so an
+// even split by line count can leave one thread holding most of the bytes.
+//
+//   static   even split by line count (the old behaviour)
+//   bytes    even split by byte count, using the batch's line offsets
+//   dynamic  threads keep claiming the next cache line worth of lines
+//            until the batch is used up
+//
+// Every split and claim is in whole cache lines of max_values.
+
+typedef enum
+{
+    SCHEDULE_STATIC,
+    SCHEDULE_BYTES,
+    SCHEDULE_DYNAMIC
+} schedule_kind;
+
+#define DEFAULT_SCHEDULE SCHEDULE_BYTES
+
+// Busy and idle time of one worker over the whole run, in seconds. Idle is
+// time spent waiting for the other threads to finish the batch. Padded so
+// every thread updates its own cache line.
+typedef struct
+{
+    double busy;
+    double idle;
+    long lines;
+    size_t bytes; // Line bytes scanned, for the per-node bandwidth (topology.h)
+    char pad[CACHE_LINE - 2 * sizeof(double) - sizeof(long) - sizeof(size_t)];
+} thread_stats;
+
+// Name on the command line to kind. Returns 0, or -1 for an unknown name.
+int schedule_parse(const char *name, schedule_kind *kind);
+const char *schedule_name(schedule_kind kind);
+
+// Lines [start, end) of part out of parts for the static and bytes schedules
+void schedule_part(schedule_kind kind, const line_batch *batch, int part, int parts, long *start, long *end);
+
+// Output parts of a batch: one per thread, or one per cache line worth of
+// lines for the dynamic schedule (each claimed chunk is rendered on its own)
+int schedule_parts(schedule_kind kind, long lines, int threads);
+
+// Write the schedule and every thread's busy and idle time to the times file
+void schedule_report(FILE *fp, schedule_kind kind, const thread_stats *stats, int threads);
+
+#endif
@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "stream_input.h"
+#include "trace.h"
+
+// Loader thread: fills the next free block of the ring until the input ends
+static void *load_blocks(void *arg)
+{
+    stream_input *in = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&in->lock);
+        while (in->loaded - in->used == in->block_count && !in->stop)
+            pthread_cond_wait(&in->changed, &in->lock);
+        int stop = in->stop;
+        char *block = in->blocks[in->loaded % in->block_count];
+        pthread_mutex_unlock(&in->lock);
+
+        if (stop)
+            break;
+
+        // The kernel reads the next depth blocks of a file while this one is copied
+        if (in->depth > 0)
+            posix_fadvise(in->fd, in->next_read + in->block_size, (off_t)in->depth * in->block_size,
+                          POSIX_FADV_WILLNEED);
+
+        // A pipe hands back at most a pipe buffer per read(), fill the whole block
+        size_t got = 0;
+        int error = 0;
+        while (got < in->block_size)
+        {
+            ssize_t n = in->depth > 0 ? pread(in->fd, block + got, in->block_size - got, in->next_read + got)
+                                      : read(in->fd, block + got, in->block_size - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                error = errno;
+            if (n <= 0)
+                break;
+            got += n;
+        }
+
+        in->next_read += got;
+
+        pthread_mutex_lock(&in->lock);
+        if (got > 0)
+        {
+            in->filled[in->loaded % in->block_count] = got;
+            in->loaded++;
+        }
+        if (got < in->block_size)
+        {
+            in->done = 1;
+            in->error = error;
+        }
+        pthread_cond_broadcast(&in->changed);
+        pthread_mutex_unlock(&in->lock);
+
+        if (got < in->block_size)
+            break;
+    }
+
+    return NULL;
+}
+
+// File offset and length of block number block of a file
+static uint64_t block_offset(const stream_input *in, uint64_t block)
+{
+    return in->first_read + block * in->block_size;
+}
+
+static size_t block_length(const stream_input *in, uint64_t block)
+{
+    uint64_t offset = block_offset(in, block);
+    return in->file_end - offset < in->block_size ? in->file_end - offset : in->block_size;
+}
+
+// Queue the rest of the read of block number block. A full submission
+// ring (entries the kernel did not take yet) is submitted first to make
+// room. Returns 0, or -1 with errno set when the read could not be queued.
+static int queue_block(stream_input *in, uint64_t block)
+{
+    int slot = block % in->block_count;
+    size_t got = in->filled[slot];
+    size_t length = block_length(in, block) - got;
+    uint64_t offset = block_offset(in, block) + got;
+
+    if (uring_read(&in->ring, in->fd, in->blocks[slot] + got, length, offset, slot, block) == 0)
+        return 0;
+    if (uring_submit(&in->ring, 0) != 0)
+        return -1;
+    if (uring_read(&in->ring, in->fd, in->blocks[slot] + got, length, offset, slot, block) == 0)
+        return 0;
+
+    errno = EBUSY;
+    return -1;
+}
+
+// Loader thread with io_uring: keeps up to depth reads in flight, each into
+// its own free block, and passes the completed blocks on in file order
+static void *load_blocks_uring(void *arg)
+{
+    stream_input *in = arg;
+    uint64_t next = 0; // Next block to read
+    int inflight = 0;
+    int end = 0;       // Every block up to the end of the file is queued
+    int error = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&in->lock);
+        while (inflight == 0 && !end && next - in->used == (uint64_t)in->block_count && !in->stop)
+            pthread_cond_wait(&in->changed, &in->lock);
+        int stop = in->stop;
+        uint64_t used = in->used;
+        pthread_mutex_unlock(&in->lock);
+
+        if (stop || (end && inflight == 0))
+            break;
+
+        while (!end && inflight < in->depth && next - used < (uint64_t)in->block_count)
+        {
+            if (block_offset(in, next) >= in->file_end)
+            {
+                end = 1;
+                break;
+            }
+            in->filled[next % in->block_count] = 0;
+            in->ready[next % in->block_count] = 0;
+            if (queue_block(in, next) != 0)
+            {
+                error = errno;
+                break;
+            }
+            next++;
+            inflight++;
+        }
+        if (error != 0)
+            break;
+        if (inflight == 0)
+            continue;
+
+        if (uring_submit(&in->ring, 1) != 0)
+        {
+            error = errno;
+            break;
+        }
+
+        uint64_t block;
+        int result;
+        while (uring_complete(&in->ring, &block, &result))
+        {
+            int slot = block % in->block_count;
+            inflight--;
+
+            if (result == -EAGAIN || result == -EINTR)
+            {
+                if (queue_block(in, block) != 0)
+                {
+                    error = errno;
+                    end = 1;
+                    continue;
+                }
+                inflight++;
+                continue;
+            }
+            if (result < 0)
+            {
+                error = -result;
+                end = 1;
+                continue;
+            }
+            if (result == 0)
+            {
+                // The file got shorter since it was opened
+                in->ready[slot] = 1;
+                end = 1;
+                continue;
+            }
+
+            in->filled[slot] += result;
+            if (in->filled[slot] < block_length(in, block))
+            {
+                // Short read, read the rest
+                if (queue_block(in, block) != 0)
+                {
+                    error = errno;
+                    end = 1;
+                    continue;
+                }
+                inflight++;
+            }
+            else
+                in->ready[slot] = 1;
+        }
+
+        // Blocks go to the reader in file order, whatever order they completed in
+        pthread_mutex_lock(&in->lock);
+        while (in->loaded < (long)next && in->ready[in->loaded % in->block_count] &&
+               in->filled[in->loaded % in->block_count] > 0)
+        {
+            in->ready[in->loaded % in->block_count] = 0;
+            in->loaded++;
+        }
+        if (error != 0 || (end && inflight == 0))
+        {
+            in->done = 1;
+            in->error = error;
+        }
+        pthread_cond_broadcast(&in->changed);
+        pthread_mutex_unlock(&in->lock);
+
+        if (error != 0)
+            break;
+    }
+
+    // The kernel may still be writing into blocks that are about to be freed
+    uint64_t block;
+    int result;
+    while (inflight > 0 && uring_submit(&in->ring, 1) == 0)
+    {
+        while (uring_complete(&in->ring, &block, &result))
+            inflight--;
+    }
+
+    pthread_mutex_lock(&in->lock);
+    in->done = 1;
+    if (in->error == 0)
+        in->error = error;
+    pthread_cond_broadcast(&in->changed);
+    pthread_mutex_unlock(&in->lock);
+    return NULL;
+}
+
+// Allocate the ring of block_count blocks and start loader on it
+static int start_loader(stream_input *in, size_t block_size, int block_count, void *(*loader)(void *))
+{
+    // Page-aligned blocks, io_uring registers them and the kernel reads straight into them
+    size_t alloc_size = (block_size + 4095) & ~(size_t)4095;
+
+    in->block_size = block_size;
+    in->block_count = block_count;
+
+    in->blocks = calloc(block_count, sizeof(char *));
+    in->filled = calloc(block_count, sizeof(size_t));
+    in->ready = calloc(block_count, 1);
+    if (in->blocks == NULL || in->filled == NULL || in->ready == NULL)
+        goto fail;
+
+    for (int b = 0; b < block_count; b++)
+    {
+        if ((in->blocks[b] = aligned_alloc(4096, alloc_size)) == NULL)
+            goto fail;
+    }
+
+    if (loader == load_blocks_uring)
+    {
+        // Registered buffers spare the kernel pinning every block again for every read;
+        // over RLIMIT_MEMLOCK the reads just go to plain buffers
+        struct iovec *buffers = malloc(block_count * sizeof(struct iovec));
+        if (buffers == NULL)
+            goto fail;
+        for (int b = 0; b < block_count; b++)
+        {
+            buffers[b].iov_base = in->blocks[b];
+            buffers[b].iov_len = alloc_size;
+        }
+        in->uring_reads = uring_register_buffers(&in->ring, buffers, block_count) == 0 ? 2 : 1;
+        free(buffers);
+    }
+
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->changed, NULL);
+
+    int status = pthread_create(&in->loader, NULL, loader, in);
+    if (status == 0)
+        return 0;
+
+    pthread_mutex_destroy(&in->lock);
+    pthread_cond_destroy(&in->changed);
+    errno = status;
+
+fail:
+    for (int b = 0; in->blocks != NULL && b < block_count; b++)
+        free(in->blocks[b]);
+    free(in->blocks);
+    free(in->filled);
+    free(in->ready);
+    in->blocks = NULL;
+    return -1;
+}
+
+// STREAM INPUT OPEN
+int stream_input_open(stream_input *in, int fd, size_t block_size, int block_count)
+{
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+    in->ring.fd = -1;
+    return start_loader(in, block_size, block_count, load_blocks);
+}
+
+// STREAM INPUT OPEN FILE
+int stream_input_open_file(stream_input *in, const char *path, uint64_t offset, size_t block_size, int depth)
+{
+    struct stat st;
+
+    memset(in, 0, sizeof(*in));
+    in->ring.fd = -1;
+    in->fd = open(path, O_RDONLY);
+    if (in->fd < 0)
+        return -1;
+    in->owns_fd = 1;
+
+    if (fstat(in->fd, &st) != 0)
+        goto fail;
+
+    in->depth = depth > 0 ? depth : 1;
+    in->first_read = offset;
+    in->next_read = offset;
+    in->offset = offset;
+    in->file_end = st.st_size;
+
+    // Every read in flight has a block, and the reader splits one more while the next completes
+    int block_count = in->depth + 2;
+    void *(*loader)(void *) = load_blocks_uring;
+    if (uring_init(&in->ring, in->depth) != 0)
+    {
+        in->uring_error = errno;
+        loader = load_blocks;
+        posix_fadvise(in->fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    if (start_loader(in, block_size, block_count, loader) == 0)
+        return 0;
+
+fail:
+    {
+        int saved = errno;
+        uring_free(&in->ring);
+        close(in->fd);
+        errno = saved;
+    }
+    return -1;
+}
+
+// Unsplit bytes of the current block, waiting for the loader if there are
+// none yet. Sets *length to 0 at the end of the input.
+static const char *current_block(stream_input *in, size_t *length)
+{
+    pthread_mutex_lock(&in->lock);
+
+    // Give back a block the reader is done with
+    if (in->used < in->loaded && in->pos == in->filled[in->used % in->block_count])
+    {
+        in->used++;
+        in->pos = 0;
+        pthread_cond_broadcast(&in->changed);
+    }
+
+    if (in->used == in->loaded && !in->done)
+    {
+        in->waits++;
+        while (in->used == in->loaded && !in->done)
+            pthread_cond_wait(&in->changed, &in->lock);
+    }
+
+    const char *block = NULL;
+    *length = 0;
+    if (in->used < in->loaded)
+    {
+        block = in->blocks[in->used % in->block_count] + in->pos;
+        *length = in->filled[in->used % in->block_count] - in->pos;
+    }
+
+    pthread_mutex_unlock(&in->lock);
+    return block;
+}
+
+// Append length bytes to the line being built at the end of the arena
+static int append(line_batch *batch, const char *bytes, size_t length)
+{
+    if (batch->arena.used + length > UINT32_MAX)
+    {
+        fprintf(stderr, "Error: a batch holds at most 4 GiB of lines\n");
+        exit(1);
+    }
+
+    char *copy = arena_alloc(&batch->arena, length);
+    if (copy == NULL)
+        return -1;
+
+    memcpy(copy, bytes, length);
+    return 0;
+}
+
+// STREAM INPUT READ
+// Pieces of a line from consecutive blocks land back to back in the arena,
+// so a line carried over a block boundary is contiguous like any other.
+long stream_input_read(stream_input *in, line_batch *batch, long max_lines, size_t max_bytes)
+{
+    long lines_read = 0;
+
+    batch->file_offset = in->offset;
+    batch->line_offsets[0] = 0;
+    batch->zeroed = 0;
+
+    while (lines_read < max_lines && batch->arena.used < max_bytes)
+    {
+        size_t line_start = batch->arena.used;
+        int ended = 0;
+
+        while (!ended)
+        {
+            size_t length;
+            const char *bytes = current_block(in, &length);
+            if (length == 0)
+                break;
+
+            const char *nl = memchr(bytes, '\n', length);
+            if (nl != NULL)
+            {
+                length = nl - bytes + 1;
+                ended = 1;
+            }
+
+            if (append(batch, bytes, length) != 0)
+                return -1;
+            in->pos += length;
+        }
+
+        size_t line_length = batch->arena.used - line_start;
+        if (line_length == 0)
+        {
+            // End of the input, or a failed read() after the last whole line
+            if (in->error != 0)
+            {
+                errno = in->error;
+                return -1;
+            }
+            break;
+        }
+
+        // Anything after an embedded NUL reads as 0, as with getline
+        char *line = batch->arena.base + line_start;
+        char *nul = memchr(line, '\0', line_length);
+        if (nul != NULL)
+        {
+            memset(nul, 0, line + line_length - nul);
+            batch->zeroed = 1;
+        }
+
+        in->offset += line_length;
+        lines_read++;
+        batch->line_offsets[lines_read] = batch->arena.used;
+    }
+
+    batch->bytes = batch->arena.base;
+    return lines_read;
+}
+
+// STREAM INPUT CLOSE
+void stream_input_close(stream_input *in)
+{
+    if (in->blocks == NULL)
+        return;
+
+    // The loader may be waiting for a free block, or in a read() that returns with the next data or the end of the input
+    pthread_mutex_lock(&in->lock);
+    in->stop = 1;
+    pthread_cond_broadcast(&in->changed);
+    pthread_mutex_unlock(&in->lock);
+    pthread_join(in->loader, NULL);
+
+    pthread_mutex_destroy(&in->lock);
+    pthread_cond_destroy(&in->changed);
+    for (int b = 0; b < in->block_count; b++)
+        free(in->blocks[b]);
+    free(in->blocks);
+    free(in->filled);
+    free(in->ready);
+    in->blocks = NULL;
+
+    uring_free(&in->ring);
+    if (in->owns_fd)
+        close(in->fd);
+}
+
+// STREAM INPUT REPORT
+void stream_input_report(FILE *fp, const stream_input *in)
+{
+    fprintf(fp, "\nStream: %d blocks of %zu bytes, %zu bytes of lines, %ld waits for input", in->block_count,
+            in->block_size, in->offset, in->waits);
+    if (in->depth == 0)
+        return;
+
+    if (in->uring_reads > 0)
+        fprintf(fp, " Reads: io_uring, %d in flight%s", in->depth, in->uring_reads == 2 ? " into registered blocks" : "");
+    else
+        fprintf(fp, " Reads: pread thread, %d blocks read ahead (io_uring: %s)", in->depth, strerror(in->uring_error));
+}
@@ -0,0 +1,87 @@
+#ifndef STREAM_INPUT_H
+#define STREAM_INPUT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "uring.h"
+
+// STREAM INPUT
+// Line source for input that can only be read once, front to back: a
+// decompressor piped in as the input file "-",
+//
+//     zstdcat enwiki.zst | ./pthread-exc times.txt -
+//
+// A loader thread read()s the input in STREAM_BLOCK_SIZE blocks into a
+// ring of STREAM_BLOCKS buffers that are reused as soon as the reader
+// stage has copied their lines into a batch, so the next read() overlaps
+// with splitting the last block. A line that crosses the end of a block is
+// carried into the next one. Memory is the ring plus the batches in
+// flight, however long the input is.
+//
+// The same ring reads a real file with --uring (stream_input_open_file):
+// on a cold page cache getline's small synchronous reads wait for the disk
+// or NFS one after the other, so the loader keeps depth large reads in
+// flight through io_uring instead, each into its own block of the ring
+// (registered with the kernel once), and hands the blocks to the reader in
+// file order as they complete. Where io_uring is missing or switched off
+// the loader pread()s the blocks itself and asks the kernel to read depth
+// blocks ahead of it with posix_fadvise.
+
+#define STREAM_BLOCK_SIZE (1 << 20) // Bytes per read() block
+#define STREAM_BLOCKS 4             // Blocks in the ring
+#define DEFAULT_QUEUE_DEPTH 16      // Reads in flight with --uring
+
+typedef struct
+{
+    int fd;
+    char **blocks;      // The ring
+    size_t *filled;     // Valid bytes in each block
+    size_t block_size;
+    int block_count;
+    long loaded;        // Blocks the loader has filled, block loaded % block_count is next
+    long used;          // Blocks the reader has given back
+    size_t pos;         // Bytes of block used % block_count already split into lines
+    int done;           // The loader hit the end of the input (or error)
+    int stop;           // The reader wants no more blocks
+    int error;          // errno of a failed read(), 0 if none
+    size_t offset;      // Input offset of the next line
+    long waits;         // Times the reader found the ring empty
+    int depth;          // Reads in flight for a file (stream_input_open_file), 0 for a pipe
+    int owns_fd;        // fd was opened here and is closed with the stream
+    uring ring;         // The reads in flight, ring.fd is -1 for the pread loader
+    int uring_error;    // errno that left io_uring out, 0 if none
+    int uring_reads;    // 0 pread loader, 1 io_uring, 2 io_uring into registered blocks (for the report)
+    uint64_t first_read; // File offset of block 0
+    uint64_t file_end;  // Size of the file when it was opened
+    size_t next_read;   // pread loader: file offset of the next block
+    unsigned char *ready; // io_uring: the read of the block completed
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // A block was filled or given back
+    pthread_t loader;
+} stream_input;
+
+// Start loading fd in block_count blocks of block_size bytes. Returns 0,
+// or -1 with errno set.
+int stream_input_open(stream_input *in, int fd, size_t block_size, int block_count);
+
+// Read the file at path from offset in blocks of block_size bytes with
+// depth reads in flight, through io_uring or a pread loader. Returns 0, or
+// -1 with errno set.
+int stream_input_open_file(stream_input *in, const char *path, uint64_t offset, size_t block_size, int depth);
+
+// Copy the next lines into batch's arena and line_offsets, the same way as
+// the getline readers: up to max_lines lines, stopping once the arena holds
+// max_bytes. Returns the number of lines (0 at the end of the input), or -1
+// with errno set on a read error.
+long stream_input_read(stream_input *in, line_batch *batch, long max_lines, size_t max_bytes);
+
+// Stop the loader and free the ring. fd is left open unless stream_input_open_file opened it.
+void stream_input_close(stream_input *in);
+
+// Write the ring size, how the blocks were read and how often the reader waited for input to the times file
+void stream_input_report(FILE *fp, const stream_input *in);
+
+#endif
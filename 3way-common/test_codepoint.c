@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "codepoint.h"
+
+// TEST CODEPOINT
+// Cross-checks codepoint_scan against codepoint_scan_scalar, max code
+// point and invalid count: lines of random bytes, lines strung together
+// from valid and invalid sequences, and every edge sequence placed at each
+// position around the 16-byte blocks the vector loop works on, so some of
+// them straddle two blocks. The line always ends right before a PROT_NONE
+// page, so reading past its end crashes, and starts at every alignment
+// within a cache line.
+
+#define MAX_LENGTH 300
+#define ALIGNMENTS 64
+#define RANDOM_LINES 200000
+
+// Sequences the lines are made of, with a name for the failure message
+static const struct
+{
+    const char *bytes;
+    const char *name;
+} sequences[] = {
+    {"a", "ASCII"},
+    {"~", "ASCII max"},
+    {"\xc2\x80", "2 bytes min"},
+    {"\xd0\x96", "2 bytes"},
+    {"\xdf\xbf", "2 bytes max"},
+    {"\xe0\xa0\x80", "3 bytes min"},
+    {"\xe6\x97\xa5", "3 bytes"},
+    {"\xed\x9f\xbf", "below the surrogates"},
+    {"\xee\x80\x80", "above the surrogates"},
+    {"\xef\xbf\xbf", "3 bytes max"},
+    {"\xf0\x90\x80\x80", "4 bytes min"},
+    {"\xf0\x9f\x98\x80", "4 bytes"},
+    {"\xf4\x8f\xbf\xbf", "U+10FFFF"},
+    {"\x80", "stray continuation"},
+    {"\xbf\xbf", "two stray continuations"},
+    {"\xc0\x80", "overlong C0"},
+    {"\xc1\xbf", "overlong C1"},
+    {"\xe0\x80\x80", "overlong 3 bytes"},
+    {"\xe0\x9f\xbf", "overlong 3 bytes max"},
+    {"\xf0\x80\x80\x80", "overlong 4 bytes"},
+    {"\xf0\x8f\xbf\xbf", "overlong 4 bytes max"},
+    {"\xed\xa0\x80", "surrogate"},
+    {"\xed\xbf\xbf", "last surrogate"},
+    {"\xf4\x90\x80\x80", "above U+10FFFF"},
+    {"\xf5\x80\x80\x80", "F5 lead"},
+    {"\xff", "FF"},
+    {"\xc3", "2 bytes cut after 1"},
+    {"\xe6\x97", "3 bytes cut after 2"},
+    {"\xe6", "3 bytes cut after 1"},
+    {"\xf0\x9f\x98", "4 bytes cut after 3"},
+    {"\xf0\x9f", "4 bytes cut after 2"},
+    {"\xe2\x82\xac\xac", "extra continuation"},
+    {"\x00", "NUL"}, // Last, put() knows its length is 1
+};
+
+#define SEQUENCES (int)(sizeof(sequences) / sizeof(sequences[0]))
+
+static int failures = 0;
+
+static void check(const unsigned char *p, size_t len, const char *what, size_t position)
+{
+    int expected[2], got[2];
+
+    codepoint_scan_scalar(p, len, expected);
+    codepoint_scan(p, len, got);
+
+    if ((got[0] != expected[0] || got[1] != expected[1]) && failures++ < 10)
+    {
+        fprintf(stderr, "codepoint: %s at %zu, length %zu: got max %d invalid %d, expected %d %d\n  ", what,
+                position, len, got[0], got[1], expected[0], expected[1]);
+        for (size_t i = 0; i < len; i++)
+            fprintf(stderr, "%02x", p[i]);
+        fprintf(stderr, "\n");
+    }
+}
+
+// Append sequence s at p, at most room bytes. Returns the bytes written.
+static size_t put(unsigned char *p, size_t room, int s)
+{
+    size_t length = s == SEQUENCES - 1 ? 1 : strlen(sequences[s].bytes);
+
+    if (length > room)
+        length = room;
+    memcpy(p, sequences[s].bytes, length);
+    return length;
+}
+
+// Check the len bytes built at line flush against the guard page at end,
+// then at every alignment within a cache line
+static void check_everywhere(unsigned char *map, size_t room, unsigned char *line, size_t len, const char *what,
+                             size_t position)
+{
+    unsigned char *end = map + room;
+    unsigned char copy[MAX_LENGTH + 1];
+
+    memcpy(copy, line, len);
+    for (size_t align = 0; align < ALIGNMENTS; align++)
+    {
+        unsigned char *p = end - len;
+        p -= ((uintptr_t)p - align) % ALIGNMENTS;
+        memcpy(p, copy, len);
+        check(p, len, what, position);
+    }
+    memcpy(end - len, copy, len);
+    check(end - len, len, what, position);
+}
+
+int main()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t room = (MAX_LENGTH + 1 + ALIGNMENTS + page - 1) / page * page;
+    unsigned char line[MAX_LENGTH + 1];
+    unsigned seed = 12345;
+
+    // The bytes, then a guard page
+    unsigned char *map = mmap(NULL, room + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || mprotect(map + room, page, PROT_NONE) != 0)
+    {
+        perror("Error mapping the test buffer");
+        return 1;
+    }
+    unsigned char *end = map + room;
+
+    // Every sequence after 0..40 ASCII bytes and before one of each kind,
+    // so it starts at every position of the first blocks and ends on,
+    // before and past the last byte of a block, and with the line
+    for (int s = 0; s < SEQUENCES; s++)
+    {
+        for (size_t position = 0; position <= 40; position++)
+        {
+            for (int after = 0; after < SEQUENCES; after++)
+            {
+                for (int newline = 0; newline < 2; newline++)
+                {
+                    size_t len = position;
+                    memset(line, 'x', position);
+                    len += put(line + len, MAX_LENGTH - len, s);
+                    len += put(line + len, MAX_LENGTH - len, after);
+                    // Enough ASCII after it for a whole vector block, when the line goes on
+                    for (int k = 0; k < (after & 3) * 8; k++)
+                        line[len++] = 'y';
+                    if (newline)
+                        line[len++] = '\n';
+                    check_everywhere(map, room, line, len, sequences[s].name, position);
+                }
+            }
+        }
+    }
+
+    // Lines strung together from random sequences, and random bytes
+    for (long n = 0; n < RANDOM_LINES; n++)
+    {
+        size_t target = rand_r(&seed) % (MAX_LENGTH + 1);
+        size_t len = 0;
+        int random_bytes = n % 4 == 3;
+        // Mostly valid text, with an invalid sequence every so often
+        int invalid_every = 1 + rand_r(&seed) % 64;
+
+        while (len < target)
+        {
+            if (random_bytes)
+                line[len++] = rand_r(&seed) & 0xff;
+            else
+            {
+                int s = rand_r(&seed) % invalid_every == 0 ? rand_r(&seed) % SEQUENCES : rand_r(&seed) % 13;
+                len += put(line + len, target - len, s);
+            }
+        }
+        if (len > 0 && rand_r(&seed) % 2 == 0)
+            line[len - 1] = '\n';
+
+        unsigned char *p = end - len;
+        if (n % 2 == 0)
+            p -= ((uintptr_t)p - n / 2) % ALIGNMENTS;
+        memmove(p, line, len);
+        check(p, len, random_bytes ? "random bytes" : "random sequences", 0);
+    }
+
+    printf("codepoint: %s\n", failures == 0 ? "ok" : "FAILED");
+
+    munmap(map, room + page);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "max_byte.h"
+
+// TEST MAX BYTE
+// Cross-checks the max_byte version picked for this run against the
+// scalar loop: every length 0..MAX_LENGTH at every start alignment within
+// a cache line, on random bytes (half of them >= 0x80, which compare as
+// negative signed chars) and on a few hand-made patterns. The line always
+// ends right before a PROT_NONE page, so a read past its end crashes.
+// Pick the version with MAX_BYTE_ISA, make check runs all of them.
+
+#define MAX_LENGTH 300
+#define ALIGNMENTS 64
+
+static int failures = 0;
+
+static void check(const char *p, size_t len, const char *what, size_t align)
+{
+    int expected = max_byte_scalar(p, len);
+    int got = max_byte(p, len);
+
+    if (got != expected && failures++ < 10)
+        fprintf(stderr, "%s: %s length %zu alignment %zu: got %d, expected %d\n", max_byte_isa(), what, len, align,
+                got, expected);
+}
+
+// Fill len bytes at p for pattern, using seed for the random ones
+static void fill(char *p, size_t len, int pattern, unsigned *seed)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        switch (pattern)
+        {
+        case 0: // Random, about half of them >= 0x80
+            p[i] = (char)(rand_r(seed) & 0xff);
+            break;
+        case 1: // Only bytes >= 0x80: the max is the 0 floor
+            p[i] = (char)(0x80 | (rand_r(seed) & 0x7f));
+            break;
+        case 2: // Low bytes with the max in the last position only
+            p[i] = (char)(i + 1 == len ? 0x7f : rand_r(seed) % 0x40);
+            break;
+        default: // Low bytes with the max in the first position only
+            p[i] = (char)(i == 0 ? 0x7e : rand_r(seed) % 0x40);
+            break;
+        }
+    }
+}
+
+int main()
+{
+    static const char *patterns[] = {"random", "high bytes", "max last", "max first"};
+    long page = sysconf(_SC_PAGESIZE);
+    size_t room = (MAX_LENGTH + ALIGNMENTS + page - 1) / page * page;
+    unsigned seed = 12345;
+
+    // The bytes, then a guard page
+    char *map = mmap(NULL, room + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED || mprotect(map + room, page, PROT_NONE) != 0)
+    {
+        perror("Error mapping the test buffer");
+        return 1;
+    }
+    char *end = map + room;
+
+    const char *wanted = getenv("MAX_BYTE_ISA");
+    const char *isa = max_byte_isa();
+
+    for (int pattern = 0; pattern < 4; pattern++)
+    {
+        for (size_t len = 0; len <= MAX_LENGTH; len++)
+        {
+            for (size_t align = 0; align < ALIGNMENTS; align++)
+            {
+                // The line starts align bytes past a cache line, at most one line before the guard page
+                char *p = end - len;
+                p -= ((uintptr_t)p - align) % ALIGNMENTS;
+                memset(map, 0, room);
+                fill(p, len, pattern, &seed);
+                check(p, len, patterns[pattern], align);
+
+                // The same bytes flush against the guard page
+                memmove(end - len, p, len);
+                check(end - len, len, patterns[pattern], (uintptr_t)(end - len) % ALIGNMENTS);
+            }
+        }
+    }
+
+    if (wanted != NULL && *wanted != '\0' && strcmp(wanted, isa) != 0)
+        printf("max_byte %s: not on this CPU, checked %s instead\n", wanted, isa);
+    printf("max_byte %s: %s\n", isa, failures == 0 ? "ok" : "FAILED");
+
+    munmap(map, room + page);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#include "topology.h"
+
+#define SYSFS_NODE "/sys/devices/system/node/node%d/cpulist"
+#define SYSFS_PACKAGE "/sys/devices/system/cpu/cpu%d/topology/physical_package_id"
+#define SYSFS_CORE "/sys/devices/system/cpu/cpu%d/topology/core_id"
+
+static const char *pin_names[] = {"none", "compact", "spread"};
+
+// PIN PARSE
+int pin_parse(const char *name, pin_mode *mode)
+{
+    for (int i = 0; i < (int)(sizeof(pin_names) / sizeof(pin_names[0])); i++)
+    {
+        if (strcmp(name, pin_names[i]) == 0)
+        {
+            *mode = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+const char *pin_name(pin_mode mode)
+{
+    return pin_names[mode];
+}
+
+// First line of the /sys file at path (format filled in with n) into buf,
+// NULL when it is not there
+static char *read_sysfs(char *buf, size_t size, const char *format, int n)
+{
+    char path[128];
+    snprintf(path, sizeof(path), format, n);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+
+    char *line = fgets(buf, size, fp);
+    fclose(fp);
+    return line;
+}
+
+// Integer in a /sys file, fallback when it is missing
+static int read_sysfs_int(const char *format, int n, int fallback)
+{
+    char buf[32];
+    return read_sysfs(buf, sizeof(buf), format, n) != NULL ? atoi(buf) : fallback;
+}
+
+// Order of the discovered CPUs: node, package, core, then CPU number
+static int compare_cpus(const void *a, const void *b)
+{
+    const topology_cpu *x = a, *y = b;
+
+    if (x->node != y->node)
+        return x->node - y->node;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+// TOPOLOGY DISCOVER
+void topology_discover(cpu_topology *topo)
+{
+    static int node_of[TOPOLOGY_MAX_CPUS];
+    cpu_set_t allowed;
+    char list[4096];
+
+    memset(topo, 0, sizeof(*topo));
+    memset(node_of, 0, sizeof(node_of));
+
+    // A node's cpulist is ranges like "0-7,16-23"
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++)
+    {
+        if (read_sysfs(list, sizeof(list), SYSFS_NODE, node) == NULL)
+            continue;
+
+        for (char *p = list; *p != '\0' && *p != '\n';)
+        {
+            char *end;
+            long first = strtol(p, &end, 10), last = first;
+            if (end == p)
+                break;
+            if (*end == '-')
+                last = strtol(end + 1, &end, 10);
+            for (long cpu = first; cpu <= last && cpu < TOPOLOGY_MAX_CPUS; cpu++)
+                node_of[cpu] = node;
+            p = *end == ',' ? end + 1 : end;
+        }
+    }
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        CPU_SET(0, &allowed);
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        topology_cpu *c = &topo->cpu[topo->cpus++];
+        c->cpu = cpu;
+        c->node = node_of[cpu];
+        c->package = read_sysfs_int(SYSFS_PACKAGE, cpu, 0);
+        c->core = read_sysfs_int(SYSFS_CORE, cpu, cpu);
+    }
+
+    qsort(topo->cpu, topo->cpus, sizeof(topology_cpu), compare_cpus);
+
+    // Hyperthreads of one core are next to each other after the sort
+    for (int i = 0; i < topo->cpus; i++)
+    {
+        topology_cpu *c = &topo->cpu[i];
+        const topology_cpu *prev = i > 0 ? &topo->cpu[i - 1] : NULL;
+
+        if (prev != NULL && prev->node == c->node && prev->package == c->package && prev->core == c->core)
+            c->sibling = prev->sibling + 1;
+        if (prev == NULL || prev->node != c->node)
+            topo->node_id[topo->nodes++] = c->node;
+    }
+}
+
+// TOPOLOGY PLAN
+// The CPUs are put in the order threads take them: all first hyperthreads,
+// then all second ones, ... Within one sibling level compact goes node by
+// node and spread takes one CPU from each node in turn.
+int topology_plan(const cpu_topology *topo, pin_mode mode, int threads, thread_placement *placement)
+{
+    memset(placement, 0, sizeof(*placement));
+    placement->mode = mode;
+    placement->threads = threads;
+    placement->cpu = malloc(threads * sizeof(int));
+    placement->node = malloc(threads * sizeof(int));
+    int *order = malloc((topo->cpus > 0 ? topo->cpus : 1) * sizeof(int));
+    if (placement->cpu == NULL || placement->node == NULL || order == NULL)
+    {
+        free(order);
+        return -1;
+    }
+
+    int ordered = 0;
+    for (int sibling = 0; ordered < topo->cpus; sibling++)
+    {
+        int taken[TOPOLOGY_MAX_NODES] = {0}; // CPUs of this level handed out per node (spread)
+        int added;
+
+        do
+        {
+            added = 0;
+            for (int n = 0; n < topo->nodes; n++)
+            {
+                // compact: every CPU of the node at this level, spread: the next one
+                int skip = mode == PIN_SPREAD ? taken[n] : 0;
+                for (int i = 0; i < topo->cpus; i++)
+                {
+                    const topology_cpu *c = &topo->cpu[i];
+                    if (c->node != topo->node_id[n] || c->sibling != sibling || skip-- > 0)
+                        continue;
+
+                    order[ordered++] = i;
+                    taken[n]++;
+                    added++;
+                    if (mode == PIN_SPREAD)
+                        break;
+                }
+            }
+        } while (mode == PIN_SPREAD && added > 0);
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        const topology_cpu *c = &topo->cpu[order[t % topo->cpus]];
+        placement->cpu[t] = mode == PIN_NONE ? -1 : c->cpu;
+        placement->node[t] = mode == PIN_NONE ? -1 : c->node;
+    }
+
+    free(order);
+    return 0;
+}
+
+// TOPOLOGY PIN
+int topology_pin(const thread_placement *placement, int t)
+{
+    if (placement->cpu == NULL || placement->cpu[t] < 0)
+        return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement->cpu[t], &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Prefer node for the pages of [start, end), moving the ones already there
+static int bind_range(const char *start, const char *end, int node)
+{
+    unsigned long mask[(TOPOLOGY_MAX_NODES + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))] = {0};
+
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask, TOPOLOGY_MAX_NODES + 1, MPOL_MF_MOVE);
+}
+
+// TOPOLOGY PLACE BATCH
+// Binding moves pages, so it is only redone when the arena moved or the
+// batch is over a quarter bigger or smaller than the one it was bound for
+void topology_place_batch(thread_placement *placement, const cpu_topology *topo, line_batch *batch,
+                          schedule_kind schedule)
+{
+    if (placement->mode == PIN_NONE || topo->nodes < 2 || schedule == SCHEDULE_DYNAMIC ||
+        batch->bytes != batch->arena.base || batch->lines == 0)
+        return;
+
+    size_t used = batch->line_offsets[batch->lines];
+    if (batch->placed_base == batch->bytes && used <= batch->placed_bytes + batch->placed_bytes / 4 &&
+        used >= batch->placed_bytes - batch->placed_bytes / 4)
+        return;
+
+    // Part boundaries rounded down to a page, a page shared by two parts goes to the later one
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    const char *from = (const char *)((uintptr_t)batch->bytes & ~(page - 1));
+
+    for (int t = 0; t < placement->threads; t++)
+    {
+        long start, end;
+        schedule_part(schedule, batch, t, placement->threads, &start, &end);
+
+        const char *to = t == placement->threads - 1
+                             ? batch->bytes + used
+                             : (const char *)((uintptr_t)(batch->bytes + batch->line_offsets[end]) & ~(page - 1));
+        if (to > from)
+        {
+            if (bind_range(from, to, placement->node[t]) != 0)
+                placement->place_failures++;
+            from = to;
+        }
+    }
+
+    batch->placed_base = batch->bytes;
+    batch->placed_bytes = used;
+    placement->placements++;
+    placement->placed_bytes += used;
+}
+
+// TOPOLOGY REPORT
+void topology_report(FILE *fp, const cpu_topology *topo, const thread_placement *placement,
+                     const thread_stats *stats)
+{
+    fprintf(fp, "\nNUMA: %d nodes %d cpus Pin: %s", topo->nodes, topo->cpus, pin_name(placement->mode));
+
+    // Without pinning a thread has no node, all of them count as one group
+    int groups = placement->mode == PIN_NONE ? 1 : topo->nodes;
+    for (int g = 0; g < groups; g++)
+    {
+        int threads = 0;
+        size_t bytes = 0;
+        double rate = 0;
+
+        for (int t = 0; t < placement->threads; t++)
+        {
+            if (placement->mode != PIN_NONE && placement->node[t] != topo->node_id[g])
+                continue;
+            threads++;
+            bytes += stats[t].bytes;
+            if (stats[t].busy > 0)
+                rate += stats[t].bytes / stats[t].busy;
+        }
+
+        if (placement->mode == PIN_NONE)
+            fprintf(fp, " all:");
+        else
+            fprintf(fp, " node%d:", topo->node_id[g]);
+        fprintf(fp, " %d threads %zu bytes %.3f GB/s", threads, bytes, rate / 1e9);
+    }
+
+    if (placement->mode != PIN_NONE)
+    {
+        fprintf(fp, " CPUs:");
+        for (int t = 0; t < placement->threads; t++)
+            fprintf(fp, " %d", placement->cpu[t]);
+    }
+    if (placement->placements > 0)
+        fprintf(fp, " Placed: %ld batches %zu bytes (%ld refused)", placement->placements, placement->placed_bytes,
+                placement->place_failures);
+}
+
+// TOPOLOGY FREE
+void topology_free(thread_placement *placement)
+{
+    free(placement->cpu);
+    free(placement->node);
+    placement->cpu = NULL;
+    placement->node = NULL;
+}
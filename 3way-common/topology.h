@@ -0,0 +1,100 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "schedule.h"
+
+// TOPOLOGY
+// NUMA nodes and cores of this machine, read from /sys, and where to put
+// the worker threads (--pin=):
+//
+//   none     the scheduler decides, as before
+//   compact  fill the cores of node 0, then node 1, ...: few threads stay
+//            on one socket and share its memory controller and L3
+//   spread   deal the threads round robin over the nodes, so every socket's
+//            memory bandwidth is used from the second thread on
+//
+// Either way a thread gets a core of its own before any core gets a second
+// hyperthread. Only the CPUs this process may run on are used.
+//
+// The line bytes of a getline or stream batch are written by the reader
+// thread, so left alone all of them would land on the reader's node. With
+// pinning on a machine with several nodes, topology_place_batch binds the
+// pages of each worker's part of the batch to that worker's node (mbind),
+// once per arena and again only when batch sizes change a lot. max_values
+// and the output are first written by the workers that own their parts,
+// so first touch puts them on the right node already.
+
+#define TOPOLOGY_MAX_CPUS 1024
+#define TOPOLOGY_MAX_NODES 64
+
+typedef enum
+{
+    PIN_NONE,
+    PIN_COMPACT,
+    PIN_SPREAD
+} pin_mode;
+
+typedef struct
+{
+    int cpu;     // CPU number for sched_setaffinity
+    int node;    // NUMA node, 0 without /sys/devices/system/node
+    int package; // Socket
+    int core;    // Core within the socket, hyperthreads share it
+    int sibling; // 0 for the first hyperthread of its core, 1 for the next...
+} topology_cpu;
+
+typedef struct
+{
+    int cpus;
+    topology_cpu cpu[TOPOLOGY_MAX_CPUS]; // Allowed CPUs ordered by node, package, core, sibling
+    int nodes;                           // Nodes with at least one allowed CPU
+    int node_id[TOPOLOGY_MAX_NODES];     // Their numbers, ascending
+} cpu_topology;
+
+// Where each worker runs, from topology_plan
+typedef struct
+{
+    pin_mode mode;
+    int threads;
+    int *cpu;  // CPU of thread t, -1 when not pinned
+    int *node; // NUMA node of thread t, -1 when not pinned
+    long placements; // Batches whose pages were bound to the workers' nodes
+    size_t placed_bytes;
+    long place_failures; // mbind calls the kernel refused (no NUMA, no permission)
+} thread_placement;
+
+// Name on the command line to mode. Returns 0, or -1 for an unknown name.
+int pin_parse(const char *name, pin_mode *mode);
+const char *pin_name(pin_mode mode);
+
+// Read the CPUs this process may use and their nodes, packages and cores.
+// Missing /sys files count as one node, one package, one core per CPU.
+void topology_discover(cpu_topology *topo);
+
+// CPU and node of each of threads workers for mode. Threads beyond the
+// CPUs wrap around. Returns 0, or -1 when out of memory.
+int topology_plan(const cpu_topology *topo, pin_mode mode, int threads, thread_placement *placement);
+
+// Pin the calling thread to placement's CPU for thread t (no-op when not pinned).
+// Returns 0, or -1 with errno set.
+int topology_pin(const thread_placement *placement, int t);
+
+// Bind the pages of each thread's part of batch->bytes to its node. The
+// parts are the static or bytes schedule's; the dynamic schedule has no
+// owner per byte and is left alone. Only does anything with pinning on and
+// more than one node, for batches whose bytes are their own arena.
+void topology_place_batch(thread_placement *placement, const cpu_topology *topo, line_batch *batch,
+                          schedule_kind schedule);
+
+// Write the placement and the scan bandwidth of each node's threads
+// (bytes scanned / busy time) to the times file
+void topology_report(FILE *fp, const cpu_topology *topo, const thread_placement *placement,
+                     const thread_stats *stats);
+
+void topology_free(thread_placement *placement);
+
+#endif
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS_INITIAL 1024 // Timeline events per track before the first doubling
+
+static const char *phase_names[PHASE_COUNT] = {"read", "kernel", "format", "write", "scatter", "gather", "barrier"};
+static const char *counter_names[COUNTER_COUNT] = {"bytes", "lines", "batches", "allocations", "peak_rss_kb"};
+
+// One phase on the timeline
+typedef struct
+{
+    double start, end;
+    trace_phase phase;
+} trace_event;
+
+// Everything one thread records, only that thread writes to it
+typedef struct
+{
+    char name[32];
+    double seconds[PHASE_COUNT];
+    long calls[PHASE_COUNT];
+    long counts[COUNTER_COUNT];
+    trace_event *events; // Timeline (--trace only)
+    long event_count;
+    long event_capacity;
+} trace_track;
+
+static trace_track *tracks;        // NULL while tracing is off
+static int track_capacity;
+static atomic_int track_count;
+static const char *metrics_file;
+static const char *trace_file;
+static int trace_rank;
+static double trace_start;          // trace_open time, 0 on the timeline
+static __thread trace_track *current; // This thread's track
+
+// Seconds on the monotonic clock
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
+
+// TRACE OPEN
+int trace_open(const char *metrics_path, const char *trace_path, int max_tracks, int rank)
+{
+    if (metrics_path == NULL && trace_path == NULL)
+        return 0;
+
+    tracks = calloc(max_tracks, sizeof(trace_track));
+    if (tracks == NULL)
+        return -1;
+
+    track_capacity = max_tracks;
+    atomic_store(&track_count, 0);
+    metrics_file = metrics_path;
+    trace_file = trace_path;
+    trace_rank = rank;
+    trace_start = now();
+    return 0;
+}
+
+// TRACE THREAD
+void trace_thread(const char *name, int id)
+{
+    if (tracks == NULL || current != NULL)
+        return;
+
+    int slot = atomic_fetch_add(&track_count, 1);
+    if (slot >= track_capacity)
+        return; // More threads than tracks, this one goes unrecorded
+
+    current = &tracks[slot];
+    if (id < 0)
+        snprintf(current->name, sizeof(current->name), "%s", name);
+    else
+        snprintf(current->name, sizeof(current->name), "%s %d", name, id);
+}
+
+double trace_begin(void)
+{
+    return current == NULL ? 0 : now();
+}
+
+// TRACE END
+void trace_end(trace_phase phase, double start)
+{
+    if (current == NULL)
+        return;
+
+    double end = now();
+    current->seconds[phase] += end - start;
+    current->calls[phase]++;
+
+    if (trace_file == NULL)
+        return;
+
+    if (current->event_count == current->event_capacity)
+    {
+        long capacity = current->event_capacity == 0 ? TRACE_EVENTS_INITIAL : current->event_capacity * 2;
+        trace_event *temp = realloc(current->events, capacity * sizeof(trace_event));
+        if (temp == NULL)
+            return; // Keep the totals, drop the event
+        current->events = temp;
+        current->event_capacity = capacity;
+    }
+
+    current->events[current->event_count++] = (trace_event){start, end, phase};
+}
+
+void trace_count(trace_counter counter, long n)
+{
+    if (current != NULL)
+        current->counts[counter] += n;
+}
+
+// TRACE TOTALS
+void trace_totals(double *seconds, long *counts)
+{
+    struct rusage usage;
+    int used = atomic_load(&track_count);
+
+    memset(seconds, 0, PHASE_COUNT * sizeof(double));
+    memset(counts, 0, COUNTER_COUNT * sizeof(long));
+
+    for (int t = 0; t < used && t < track_capacity; t++)
+    {
+        for (int p = 0; p < PHASE_COUNT; p++)
+            seconds[p] += tracks[t].seconds[p];
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            counts[c] += tracks[t].counts[c];
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    counts[COUNTER_PEAK_RSS_KB] = usage.ru_maxrss;
+}
+
+// "phases": {...}, "counters": {...} for one track or rank
+static void write_phases(FILE *fp, const double *seconds, const long *calls, const long *counts)
+{
+    fprintf(fp, "\"phases\": {");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        fprintf(fp, "%s\"%s\": {\"seconds\": %.6f", p ? ", " : "", phase_names[p], seconds[p]);
+        if (calls != NULL)
+            fprintf(fp, ", \"calls\": %ld", calls[p]);
+        fprintf(fp, "}");
+    }
+
+    fprintf(fp, "}, \"counters\": {");
+    for (int c = 0; c < COUNTER_COUNT; c++)
+        fprintf(fp, "%s\"%s\": %ld", c ? ", " : "", counter_names[c], counts[c]);
+    fprintf(fp, "}");
+}
+
+static int write_metrics(const char *path, int ranks, const double *rank_seconds, const long *rank_counts)
+{
+    double seconds[PHASE_COUNT];
+    long counts[COUNTER_COUNT];
+    int used = atomic_load(&track_count);
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    trace_totals(seconds, counts);
+    fprintf(fp, "{\n  \"wall_seconds\": %.6f,\n  \"total\": {", now() - trace_start);
+    write_phases(fp, seconds, NULL, counts);
+    fprintf(fp, "},\n  \"threads\": [\n");
+
+    for (int t = 0; t < used && t < track_capacity; t++)
+    {
+        fprintf(fp, "    {\"name\": \"%s\", ", tracks[t].name);
+        write_phases(fp, tracks[t].seconds, tracks[t].calls, tracks[t].counts);
+        fprintf(fp, "}%s\n", t + 1 < used && t + 1 < track_capacity ? "," : "");
+    }
+    fprintf(fp, "  ]");
+
+    if (ranks > 0)
+    {
+        fprintf(fp, ",\n  \"ranks\": [\n");
+        for (int r = 0; r < ranks; r++)
+        {
+            fprintf(fp, "    {\"rank\": %d, ", r);
+            write_phases(fp, rank_seconds + r * PHASE_COUNT, NULL, rank_counts + r * COUNTER_COUNT);
+            fprintf(fp, "}%s\n", r + 1 < ranks ? "," : "");
+        }
+        fprintf(fp, "  ]");
+    }
+
+    fprintf(fp, "\n}\n");
+    return fclose(fp);
+}
+
+// Chrome trace events in the JSON array format. Rank 0 writes the opening
+// bracket and every other rank writes path.rank without one, so
+//     cat trace.json trace.json.* > all.json
+// is one timeline (the format allows a missing closing bracket).
+static int write_trace(const char *path)
+{
+    char rank_path[4096];
+    int used = atomic_load(&track_count);
+
+    if (trace_rank > 0)
+    {
+        snprintf(rank_path, sizeof(rank_path), "%s.%d", path, trace_rank);
+        path = rank_path;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    if (trace_rank == 0)
+        fprintf(fp, "[\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}},\n",
+            trace_rank, trace_rank);
+
+    for (int t = 0; t < used && t < track_capacity; t++)
+    {
+        fprintf(fp, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                trace_rank, t, tracks[t].name);
+
+        for (long e = 0; e < tracks[t].event_count; e++)
+        {
+            const trace_event *ev = &tracks[t].events[e];
+            fprintf(fp, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f},\n",
+                    phase_names[ev->phase], trace_rank, t, (ev->start - trace_start) * 1e6, (ev->end - ev->start) * 1e6);
+        }
+    }
+
+    return fclose(fp);
+}
+
+// TRACE CLOSE
+int trace_close(int ranks, const double *rank_seconds, const long *rank_counts)
+{
+    int status = 0;
+
+    if (tracks == NULL)
+        return 0;
+
+    if (metrics_file != NULL && trace_rank == 0)
+        status |= write_metrics(metrics_file, ranks, rank_seconds, rank_counts);
+    if (trace_file != NULL)
+        status |= write_trace(trace_file);
+
+    for (int t = 0; t < track_capacity; t++)
+        free(tracks[t].events);
+    free(tracks);
+    tracks = NULL;
+    current = NULL;
+    return status;
+}
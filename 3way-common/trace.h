@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+// TRACE
+// Per-phase timers and counters for every thread (and rank), turned on
+// with --metrics=file.json and --trace=file.json. Each thread registers a
+// track once and adds to it with no locks, so the hot path costs two reads
+// of the monotonic clock (vDSO, no system call) per phase and nothing at
+// all when tracing is off.
+//
+//     double start = trace_begin();
+//     ... one batch of work ...
+//     trace_end(PHASE_KERNEL, start);
+//
+// At exit the metrics file gets every track's time and call count per
+// phase, the counters and peak RSS as JSON. The trace file gets every
+// phase as a Chrome trace event (chrome://tracing or ui.perfetto.dev),
+// one row per thread, one process per MPI rank.
+
+typedef enum
+{
+    PHASE_READ,    // getline / line indexing / pread into a batch
+    PHASE_KERNEL,  // max_byte over the lines
+    PHASE_FORMAT,  // Rendering "line: value" text
+    PHASE_WRITE,   // print_results, the writev to stdout
+    PHASE_SCATTER, // MPI: sending or receiving the chunks of a batch
+    PHASE_GATHER,  // MPI: collecting results on rank 0
+    PHASE_BARRIER, // Waiting for the other workers to finish a batch
+    PHASE_COUNT
+} trace_phase;
+
+typedef enum
+{
+    COUNTER_BYTES,       // Line bytes read (or received, MPI)
+    COUNTER_LINES,       // Lines read (or received, MPI)
+    COUNTER_BATCHES,     // Batches or chunks handled
+    COUNTER_ALLOCATIONS, // Buffers that had to grow (arena, output, MPI packets)
+    COUNTER_PEAK_RSS_KB, // Filled in by trace_totals, not counted
+    COUNTER_COUNT
+} trace_counter;
+
+// Turn tracing on for up to tracks threads. Either path can be NULL; with
+// both NULL tracing stays off. rank names the process in the trace file.
+// Returns 0, or -1 when out of memory.
+int trace_open(const char *metrics_path, const char *trace_path, int tracks, int rank);
+
+// Register the calling thread as a track named name and id (id < 0 for none).
+// Does nothing when tracing is off or the thread already has a track.
+void trace_thread(const char *name, int id);
+
+// Start time of a phase, 0 when tracing is off
+double trace_begin(void);
+
+// Add the time since start to phase on this thread's track
+void trace_end(trace_phase phase, double start);
+
+// Add n to counter on this thread's track
+void trace_count(trace_counter counter, long n);
+
+// Sum of every track of this process, for the MPI gather to rank 0
+void trace_totals(double *seconds, long *counts);
+
+// Write the metrics file (ranks and the gathered rank_seconds and
+// rank_counts, ranks x PHASE_COUNT and ranks x COUNTER_COUNT, are only
+// for MPI rank 0, pass 0 and NULL otherwise) and this process's part of
+// the trace file, then free everything. Returns 0, or -1 with errno set.
+int trace_close(int ranks, const double *rank_seconds, const long *rank_counts);
+
+#endif
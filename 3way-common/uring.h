@@ -0,0 +1,51 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+// URING
+// The little of io_uring the block reader needs, on the raw system calls
+// (liburing is not on the cluster): one submission and one completion
+// ring mapped from the kernel, reads into buffers registered once so the
+// kernel does not map and pin them again for every read.
+
+typedef struct
+{
+    int fd;                    // -1 when the ring is not set up
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    unsigned queued;           // Entries filled in since the last submit
+    int registered;            // Buffers are registered, reads use IORING_OP_READ_FIXED
+} uring;
+
+// Set up a ring with room for entries reads. Returns 0, or -1 with errno
+// set (ENOSYS or EPERM where io_uring is missing or switched off).
+int uring_init(uring *ring, unsigned entries);
+
+// Register count buffers, read_fixed then reads into them by index.
+// Returns 0, or -1 with errno set (ENOMEM over RLIMIT_MEMLOCK).
+int uring_register_buffers(uring *ring, const struct iovec *buffers, unsigned count);
+
+// Queue a read of length bytes at offset of fd into buffer (number index
+// when the buffers are registered). Returns 0, or -1 when the ring is full.
+int uring_read(uring *ring, int fd, void *buffer, unsigned length, uint64_t offset, int index, uint64_t tag);
+
+// Submit the queued reads and wait until at least wait completions are
+// there. Returns 0, or -1 with errno set.
+int uring_submit(uring *ring, unsigned wait);
+
+// Take the next completion, if there is one: its tag and result (bytes
+// read, or -errno). Returns 1 when there was one, 0 otherwise.
+int uring_complete(uring *ring, uint64_t *tag, int *result);
+
+void uring_free(uring *ring);
+
+#endif
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+for n in 1 2 4
+do
+    sbatch --job-name=my_job --output=slurm-%j.out --constraint=moles --time=0:10:00 --mem-per-cpu=1G --nodes=$n --ntasks-per-node=1 --cpus-per-task=16 --export=ALL,NUM_NODES=$n --partition=killable.q ./hybrid_batch.sh
+done
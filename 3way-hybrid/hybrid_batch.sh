@@ -0,0 +1,4 @@
+#!/bin/bash -l
+
+echo "I'm using $NUM_NODES nodes with $SLURM_CPUS_PER_TASK threads each"
+mpirun --map-by ppr:1:node --bind-to none ./hybrid-exc times-${NUM_NODES}-$RANDOM.txt --threads=$SLURM_CPUS_PER_TASK > /dev/null
@@ -4,216 +4,837 @@
 #include <mpi.h>
 #include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/resource.h>
-
-#define NUM_THREADS 8      // Number of threads to use
-#define LINES_TO_READ 1000000 // Initial allocation size for lines (change for each number of lines)
-#define MAX_LINES_IN_BATCH 1000
-
-// Declaration of print_results
-void print_results(long offset);
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mapped_input.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "histogram.h"
+#include "line_index.h"
+#include "line_stats.h"
+#include "max_byte.h"
+#include "mpi_chunks.h"
+#include "out_writer.h"
+#include "pipeline.h"
+#include "range_input.h"
+#include "result_cache.h"
+#include "results_file.h"
+#include "schedule.h"
+#include "stream_input.h"
+#include "trace.h"
+
+#define LINES_TO_READ 1000000 // Default for --lines
+#define RANGE_BLOCK_SIZE (4 << 20) // pread block size of --read=parallel
 
 // Global arrays and variables
-char **char_array;    // Array of strings (lines from the file)
-int *max_values;      // Array to store max ASCII values per line
-long total_lines = 0; // Total number of lines read from the file
-long lines_in_batch;
-
-// PROCESS BATCH MPI
-// This function processes a batch of lines and finds the max ASCII value in each line
-// It uses MPI to gather results from all processes
-void process_batch_mpi(long offset, int rank, int size)
+run_config config;    // Settings from the command line, the same on every rank
+batch_sizer sizer;    // Lines per batch, from the memory budget (rank 0)
+mpi_chunk chunk;      // This rank's slice of the current batch
+mpi_results results[2]; // Gathers of the last two batches, N-1 can still be in flight while N is computed
+long batches_started = 0; // Batches whose gather was started on this rank
+long batches_completed = 0; // Batches whose gather rank 0 waited for
+int w_size, w_rank;   // Size of MPI_COMM_WORLD and rank of this process
+FILE *input_fp;       // Input file (rank 0, getline mode)
+size_t input_pos = 0; // File offset of the next line (rank 0, getline mode)
+stream_input input_stream; // Standard input read in blocks (rank 0, input "-")
+
+// Memory-mapped input (--mmap)
+mapped_input input_map; // Mapping of the whole input file
+
+// Hybrid build (3way-hybrid): busy and idle time of each thread of the team
+thread_stats *worker_stats;
+
+// Byte counts of each thread of this rank (--histogram), NULL otherwise
+byte_histogram *histograms;
+line_stats fused_stats; // Fused kernel for the --stats results
+results_schema binary_schema; // Record layout of --output=binary
+run_checkpoint checkpoint; // Where the run started and --checkpoint progress
+line_index start_index; // Sidecar index that found --start, empty otherwise
+result_cache cache; // Results of the unchanged start of the dump (--cache)
+
+// Max ASCII value (or the letter count with --histogram, or the --stats
+// results) of lines [start, end) on thread t
+void scan_lines(int t, int *values, const char *bytes, const uint32_t *line_offsets, long start, long end)
 {
-    long lines_per_process = lines_in_batch / size;
-    long start = rank * lines_per_process;
-    long end = (rank == size - 1) ? lines_in_batch : start + lines_per_process;
+    if (histograms != NULL)
+    {
+        histogram_lines(&histograms[t], values, bytes, line_offsets, start, end);
+        return;
+    }
+    if (config.stats != 0)
+    {
+        line_stats_lines(&fused_stats, values, bytes, line_offsets, start, end);
+        return;
+    }
 
     for (long i = start; i < end; i++)
     {
-        int max = 0;
-        for (char *p = char_array[i]; *p != '\0'; p++)
+        // Find the max ASCII value with the vector kernel
+        values[i] = max_byte(bytes + line_offsets[i], line_offsets[i + 1] - line_offsets[i]);
+    }
+}
+
+// COMPUTE VALUES
+// Finds the max ASCII value of lines lines. Built with OpenMP (the hybrid
+// backend, one rank per node) the rank's team splits them by --schedule
+// the way openmp_main.c splits a batch. Only the main thread makes MPI
+// calls, before and after, which is all MPI_THREAD_FUNNELED allows.
+void compute_values(int *values, const char *bytes, const uint32_t *line_offsets, long lines)
+{
+#ifdef _OPENMP
+    if (config.threads > 1)
+    {
+        // The lines seen as a batch, for schedule_part
+        line_batch view = {0};
+        view.lines = lines;
+        view.line_offsets = (uint32_t *)line_offsets;
+        long chunks = (lines + VALUES_PER_CACHE_LINE - 1) / VALUES_PER_CACHE_LINE;
+
+        #pragma omp parallel num_threads(config.threads)
         {
-            if ((int)(*p) > max)
+            int t = omp_get_thread_num();
+            double start = omp_get_wtime();
+            double traced = trace_begin();
+            long done = 0;
+
+            trace_thread("thread", t);
+
+            if (config.schedule == SCHEDULE_DYNAMIC)
             {
-                max = (int)(*p);
+                #pragma omp for schedule(dynamic, 1) nowait
+                for (long c = 0; c < chunks; c++)
+                {
+                    long first = c * VALUES_PER_CACHE_LINE;
+                    long last = first + VALUES_PER_CACHE_LINE < lines ? first + VALUES_PER_CACHE_LINE : lines;
+                    scan_lines(t, values, bytes, line_offsets, first, last);
+                    done += last - first;
+                }
             }
+            else
+            {
+                #pragma omp for schedule(static, 1) nowait
+                for (int part = 0; part < config.threads; part++)
+                {
+                    long first, last;
+                    schedule_part(config.schedule, &view, part, config.threads, &first, &last);
+                    scan_lines(t, values, bytes, line_offsets, first, last);
+                    done += last - first;
+                }
+            }
+            if (histograms != NULL)
+                histogram_fold(&histograms[t]);
+            trace_end(PHASE_KERNEL, traced);
+
+            // Idle until the slowest thread is done with the chunk
+            double finish = omp_get_wtime();
+            traced = trace_begin();
+            #pragma omp barrier
+            trace_end(PHASE_BARRIER, traced);
+            worker_stats[t].busy += finish - start;
+            worker_stats[t].idle += omp_get_wtime() - finish;
+            worker_stats[t].lines += done;
         }
+        return;
+    }
+#endif
+
+    double traced = trace_begin();
+    scan_lines(0, values, bytes, line_offsets, 0, lines);
+    if (histograms != NULL)
+        histogram_fold(&histograms[0]);
+    trace_end(PHASE_KERNEL, traced);
+}
+
+// PROCESS BATCH MPI
+// This function processes this rank's chunk of the batch and finds the max ASCII value in each line
+void process_batch_mpi(int *values)
+{
+    // Lines come from this rank's packet, or from its own mapping in mmap mode
+    const char *bytes = chunk.bytes != NULL ? chunk.bytes : input_map.data + chunk.file_offset;
+
+    compute_values(values, bytes, chunk.line_offsets, chunk.lines);
+}
+
+// FORMAT RESULTS
+// --gather=text: renders this rank's results in the output format so rank 0
+// can write the gathered bytes as they are
+size_t format_results(mpi_results *res, const int *values)
+{
+    char *text = results_text(res, chunk.lines * format_line_max());
+    if (text == NULL)
+    {
+        perror("Error allocating memory for the formatted results");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    return format_lines(text, chunk.offset + chunk.first_line, values, chunk.lines);
+}
 
-        max_values[i] = max;
+// GATHER CHUNK
+// Starts the non-blocking gather of this rank's results to rank 0
+// (root_batch is the batch on rank 0 and NULL everywhere else)
+void gather_chunk(mpi_results *res, int *values, line_batch *root_batch)
+{
+    double traced = trace_begin();
+
+    if (config.gather_text)
+    {
+        size_t length = format_results(res, values);
+        trace_end(PHASE_FORMAT, traced);
+
+        traced = trace_begin();
+        results_gather_text(res, length, root_batch, MPI_COMM_WORLD);
     }
+    else
+        results_gather_values(res, &chunk, root_batch == NULL ? NULL : root_batch->max_values, MPI_COMM_WORLD);
+
+    trace_end(PHASE_GATHER, traced);
+}
 
-    MPI_Gather(max_values + start, lines_per_process, MPI_INT, max_values, lines_per_process, MPI_INT, 0, MPI_COMM_WORLD);
+// Buffer for this rank's results of the current chunk
+int *chunk_values(mpi_results *res, line_batch *root_batch)
+{
+    // Rank 0 computes its values in place when values are gathered
+    if (root_batch != NULL && !config.gather_text)
+        return root_batch->max_values + chunk.first_line * batch_value_fields;
 
-    if (rank == 0)
+    int *values = results_values(res, chunk.lines);
+    if (values == NULL)
     {
-        print_results(offset);
+        perror("Error allocating memory for the results");
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
+
+    return values;
+}
+
+// DISTRIBUTE BATCH
+// Rank 0's pipeline compute stage: scatters every rank its slice of the
+// batch, processes its own share and starts gathering the results. All MPI
+// calls stay on the main thread, the reader and writer threads never touch MPI.
+void distribute_batch(line_batch *batch)
+{
+    mpi_results *res = &results[batches_started++ % 2];
+
+    double traced = trace_begin();
+    chunk_scatter(&chunk, batch, !config.use_mmap || batch->zeroed, MPI_COMM_WORLD);
+    trace_end(PHASE_SCATTER, traced);
+
+    int *values = chunk_values(res, batch);
+    process_batch_mpi(values);
+    gather_chunk(res, values, batch);
+}
+
+// COMPLETE BATCH
+// Rank 0's pipeline complete stage: runs once the next batch has been
+// computed, so the gather below overlapped with that work
+void complete_batch(line_batch *batch)
+{
+    (void)batch; // The pipeline's callback signature, the gather to wait for is in results[]
+    double traced = trace_begin();
+    results_wait(&results[batches_completed++ % 2]);
+    trace_end(PHASE_GATHER, traced);
 }
 
-// PRINT RESULTS (and free memory)
+// PRINT RESULTS
 // Output format: line_number: max_ascii_value
-void print_results(long offset)
+// Runs on rank 0's pipeline writer thread
+void print_results(line_batch *batch)
 {
-    for (long i = 0; i < lines_in_batch; i++)
+    // With --gather=text the ranks already formatted their lines,
+    // otherwise the gathered values are rendered here in one pass
+    if (!config.gather_text)
+    {
+        if (batch_output_reserve(batch, 1) != 0)
+        {
+            perror("Error allocating memory for the batch output");
+            exit(1);
+        }
+        format_batch_part(batch, 0, 1);
+    }
+
+    // Keep the results and the hash of the batch's bytes for the next run
+    if (result_cache_record(&cache, batch, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+    {
+        perror("Error writing the result cache");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    if (config.output != OUTPUT_NONE && write_batch_output(batch, STDOUT_FILENO) != 0)
+    {
+        perror("Error writing results");
+        exit(1);
+    }
+
+    // Every line before the next batch is written now
+    if (checkpoint_save(&checkpoint, batch->offset + batch->lines, batch->file_offset + batch->line_offsets[batch->lines],
+                        config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+    {
+        perror("Error writing the checkpoint");
+        exit(1);
+    }
+
+    if (config.use_mmap)
     {
-        printf("%ld: %d\n", i + offset, max_values[i]);
-        free(char_array[i]);
+        // Every line up to the end of this batch is done
+        mapped_input_release(&input_map, batch->file_offset + batch->line_offsets[batch->lines]);
     }
 }
 
 // INITIALIZE ARRAYS
-// Reads the file line-by-line into dynamically allocated char_array
-long init_arrays(FILE *fp, long lines_remaining)
+// Reads the file line-by-line into the batch's bytes and line_offsets,
+// stopping after lines_remaining lines or once max_bytes bytes are in
+long init_arrays(FILE *fp, line_batch *batch, long lines_remaining, size_t max_bytes)
 {
     char *line = NULL;
     size_t len = 0;
     ssize_t read;
-    size_t char_array_size = MAX_LINES_IN_BATCH;
 
     long lines_read = 0;
-    // keep track of memory usage to reduce freezing
 
-    // Allocate initial space for char_array
-    char_array = malloc(char_array_size * sizeof(char *));
-    max_values = malloc(char_array_size * sizeof(int));
-
-    if (char_array == NULL || max_values == NULL)
-    {
-        perror("Error allocating memory for char_array or max_values");
-        exit(1);
-    }
+    batch->file_offset = input_pos;
+    batch->line_offsets[0] = 0;
+    batch->zeroed = 0;
 
     // Read each line from the file
-    while ((read = getline(&line, &len, fp)) != -1)
+    while (lines_read < lines_remaining && batch->arena.used < max_bytes && (read = getline(&line, &len, fp)) != -1)
     {
-        // Resize char_array if necessary
-        if (lines_read >= (long)char_array_size)
+        // Append the line to the batch's bytes, offsets stay valid when the arena grows
+        if (batch->arena.used + read > UINT32_MAX)
         {
-            char_array_size *= 2;
-            char **temp = realloc(char_array, char_array_size * sizeof(char *));
-            int *temp_max = realloc(max_values, char_array_size * sizeof(int));
-            if (temp == NULL || temp_max == NULL)
-            {
-                perror("Error reallocating memory");
-                exit(1);
-            }
-            char_array = temp;
-            max_values = temp_max;
-
-            // Initialize memory for new character and integers being read in
-            memset(char_array + lines_read, 0, (char_array_size - lines_read) * sizeof(char *));
-            memset(max_values + lines_read, 0, (char_array_size - lines_read) * sizeof(int));
+            fprintf(stderr, "Error: a batch holds at most 4 GiB of lines\n");
+            exit(1);
         }
-        // Allocate space for the line and copy it in
-        char_array[lines_read] = malloc(read + 1);
 
-        if (char_array[lines_read] == NULL)
+        char *copy = arena_alloc(&batch->arena, read);
+        if (copy == NULL)
         {
             perror("Error allocating line memory");
             exit(1);
         }
 
-        // load pages into RAM
-        memset(char_array[lines_read], 0, read + 1);
-        snprintf(char_array[lines_read], read + 1, "%s", line);
-        lines_read++;
+        // Copied as a C string, so anything after an embedded NUL reads as 0
+        size_t copied = strnlen(line, read);
+        memcpy(copy, line, copied);
+        memset(copy + copied, 0, read - copied);
+        batch->zeroed |= copied < (size_t)read;
 
-        if (lines_read >= lines_remaining)
-            break;
+        input_pos += read;
+        lines_read++;
+        batch->line_offsets[lines_read] = batch->arena.used;
     }
 
+    // The arena only moves while lines are appended, its final place holds them all
+    batch->bytes = batch->arena.base;
+
     // Clean up
     free(line);
     return lines_read;
 }
 
+// READ BATCH
+// Rank 0's pipeline reader stage: fills the next batch with getline, from the mapping or from the stream
+long read_batch(line_batch *batch)
+{
+    long lines_remaining = config.lines - (batch->offset - config.start);
+    long batch_size = batch_sizer_next(&sizer, batch);
+
+    if (lines_remaining < batch_size)
+        batch_size = lines_remaining;
+    if (batch_size <= 0)
+        return 0;
+
+    if (config.use_mmap)
+    {
+        int has_nul;
+        long lines = mapped_input_index(&input_map, batch->line_offsets, batch_size, sizer.target_bytes,
+                                        &batch->file_offset, &has_nul);
+        batch->bytes = input_map.data + batch->file_offset;
+        batch->zeroed = 0;
+
+        // The mapping is read-only, a line that getline would cut at a NUL goes through a copy
+        if (has_nul && batch_copy_lines(batch, lines) != 0)
+        {
+            perror("Error allocating line memory");
+            exit(1);
+        }
+        return lines;
+    }
+
+    if (config.use_stream || config.use_uring)
+    {
+        long lines = stream_input_read(&input_stream, batch, batch_size, sizer.target_bytes);
+        if (lines < 0)
+        {
+            perror("Error reading the input");
+            exit(1);
+        }
+        return lines;
+    }
+
+    return init_arrays(input_fp, batch, batch_size, sizer.target_bytes);
+}
+
+// READ OWN RANGE
+// --read=parallel: every rank preads its own byte range of the dump and
+// computes it, so input bandwidth grows with the number of ranks. A prefix
+// sum of the line counts then gives each rank its first global line number
+// and rank 0 collects the results in line order.
+void read_own_range()
+{
+    struct stat st;
+    off_t start, end;
+    range_reader reader;
+    int *values = NULL;
+    long count = 0, capacity = 0;
+
+    uint32_t *line_offsets = malloc((sizer.max_lines + 1) * sizeof(uint32_t));
+    int fd = open(config.input_path, O_RDONLY);
+    if (line_offsets == NULL || fd < 0 || fstat(fd, &st) != 0 ||
+        range_for_rank(fd, st.st_size, w_rank, w_size, &start, &end) != 0 ||
+        range_reader_open(&reader, fd, start, end, RANGE_BLOCK_SIZE) != 0)
+    {
+        perror("Error opening this rank's range of the file");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Lines come a block at a time, so sizer.max_lines only caps the
+    // line count and there are no stage times to adapt to.
+    // A rank never needs more than config.lines lines of its own range,
+    // every rank before it only pushes its lines further back
+    while (count < config.lines)
+    {
+        long lines_remaining = config.lines - count;
+        long batch_size = lines_remaining < sizer.max_lines ? lines_remaining : sizer.max_lines;
+
+        double traced = trace_begin();
+        long lines_read = range_reader_next(&reader, line_offsets, batch_size);
+        trace_end(PHASE_READ, traced);
+
+        if (lines_read < 0)
+        {
+            perror("Error reading this rank's range of the file");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (lines_read == 0)
+            break;
+
+        if (count + lines_read > capacity)
+        {
+            capacity = capacity * 2 > count + lines_read ? capacity * 2 : count + lines_read;
+            values = realloc(values, capacity * batch_value_fields * sizeof(int));
+            if (values == NULL)
+            {
+                perror("Error allocating memory for the results");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+
+        compute_values(values + count * batch_value_fields, reader.buf, line_offsets, lines_read);
+
+        trace_count(COUNTER_LINES, lines_read);
+        trace_count(COUNTER_BYTES, line_offsets[lines_read] - line_offsets[0]);
+        trace_count(COUNTER_BATCHES, 1);
+        count += lines_read;
+    }
+
+    range_reader_close(&reader);
+    close(fd);
+    free(line_offsets);
+
+    // Global line number of this rank's first line (MPI_Exscan leaves rank 0's undefined)
+    double traced = trace_begin();
+    long first_line = 0;
+    MPI_Exscan(&count, &first_line, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (w_rank == 0)
+        first_line = 0;
+
+    // Only lines below config.lines are printed
+    long keep = config.lines - first_line;
+    if (keep < 0)
+        keep = 0;
+    if (keep > count)
+        keep = count;
+
+    int send = keep * batch_value_fields;
+    int *counts = NULL, *displs = NULL, *all_values = NULL;
+    long total = 0; // Values, batch_value_fields per line
+
+    if (w_rank == 0)
+    {
+        counts = malloc(w_size * sizeof(int));
+        displs = malloc(w_size * sizeof(int));
+        if (counts == NULL || displs == NULL)
+        {
+            perror("Error allocating memory for the gather");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    MPI_Gather(&send, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (w_rank == 0)
+    {
+        for (int r = 0; r < w_size; r++)
+        {
+            displs[r] = total;
+            total += counts[r];
+        }
+
+        all_values = malloc((total > 0 ? total : 1) * sizeof(int));
+        if (all_values == NULL)
+        {
+            perror("Error allocating memory for the results");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    MPI_Gatherv(values, send, MPI_INT, all_values, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    trace_end(PHASE_GATHER, traced);
+
+    if (w_rank == 0)
+    {
+        // Render and write a batch worth of lines at a time
+        line_batch out = {0};
+        long total_lines = total / batch_value_fields;
+        for (long i = 0; i < total_lines; i += sizer.max_lines)
+        {
+            out.offset = i;
+            out.lines = total_lines - i < sizer.max_lines ? total_lines - i : sizer.max_lines;
+            out.max_values = all_values + i * batch_value_fields;
+
+            traced = trace_begin();
+            if (batch_output_reserve(&out, 1) != 0)
+            {
+                perror("Error allocating memory for the output");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            format_batch_part(&out, 0, 1);
+            trace_end(PHASE_FORMAT, traced);
+
+            traced = trace_begin();
+            if (config.output != OUTPUT_NONE && write_batch_output(&out, STDOUT_FILENO) != 0)
+            {
+                perror("Error writing results");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            trace_end(PHASE_WRITE, traced);
+        }
+        free(out.output);
+        free(out.output_parts);
+    }
+
+    free(values);
+    free(counts);
+    free(displs);
+    free(all_values);
+}
+
+// CLOSE HISTOGRAM
+// Sums the threads' counts on each rank, then the ranks' on rank 0 (MPI_Reduce is a tree too), which writes the file
+void close_histogram()
+{
+    uint64_t total[HISTOGRAM_BINS];
+
+    histogram_merge(histograms, config.threads);
+    MPI_Reduce(histograms[0].total, total, HISTOGRAM_BINS, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (w_rank == 0 && histogram_write(config.histogram_path, total) != 0)
+    {
+        perror("Error writing the histogram");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    free(histograms);
+}
+
+// CLOSE TRACE
+// Collects every rank's phase totals and counters on rank 0 for the
+// metrics file, then every rank writes its part of the timeline
+void close_trace()
+{
+    double seconds[PHASE_COUNT];
+    long counts[COUNTER_COUNT];
+    double *rank_seconds = NULL;
+    long *rank_counts = NULL;
+
+    if (config.metrics_path != NULL)
+    {
+        trace_totals(seconds, counts);
+
+        if (w_rank == 0)
+        {
+            rank_seconds = malloc(w_size * PHASE_COUNT * sizeof(double));
+            rank_counts = malloc(w_size * COUNTER_COUNT * sizeof(long));
+            if (rank_seconds == NULL || rank_counts == NULL)
+            {
+                perror("Error allocating memory for the metrics");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+
+        MPI_Gather(seconds, PHASE_COUNT, MPI_DOUBLE, rank_seconds, PHASE_COUNT, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        MPI_Gather(counts, COUNTER_COUNT, MPI_LONG, rank_counts, COUNTER_COUNT, MPI_LONG, 0, MPI_COMM_WORLD);
+    }
+
+    if (trace_close(w_rank == 0 ? w_size : 0, rank_seconds, rank_counts) != 0)
+    {
+        perror("Error writing the metrics or trace file");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    free(rank_seconds);
+    free(rank_counts);
+}
+
 // MAIN FUNCTION
 // Controls program flow: setup, thread management, output, cleanup
 int main(int argc, char *args[])
 {
-    int w_size, w_rank;
+    int provided;
 
     // Initialize MPI and find the size and rank of the process
-    MPI_Init(&argc, &args);
+    // Rank 0 runs reader and writer threads, but only the main thread calls MPI
+    MPI_Init_thread(&argc, &args, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(MPI_COMM_WORLD, &w_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &w_rank);
 
+    if (provided < MPI_THREAD_FUNNELED)
+    {
+        fprintf(stderr, "Error: this MPI library has no MPI_THREAD_FUNNELED support\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
     // Structs to hold the time and usage
     struct timespec start, end;
     struct rusage usage;
+    pipeline_stats stats = {0};
+
+    // Settings from the command line (every rank parses the same arguments)
+    config_init(&config, LINES_TO_READ);
+#ifdef _OPENMP
+    // Hybrid: a team of --threads threads per rank, one rank per node
+    if (config_parse(&config, argc, args, CONFIG_MPI | CONFIG_THREADS | CONFIG_SCHEDULE) != 0)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+#else
+    if (config_parse(&config, argc, args, CONFIG_MPI) != 0)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    config.threads = 1; // Every rank computes on its main thread
+#endif
+
+    worker_stats = aligned_alloc(CACHE_LINE, config.threads * sizeof(thread_stats));
+    if (worker_stats == NULL)
+    {
+        perror("Error allocating memory for the thread stats");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memset(worker_stats, 0, config.threads * sizeof(thread_stats));
+
+    if (config.histogram_path != NULL && (histograms = histogram_alloc(config.threads)) == NULL)
+    {
+        perror("Error allocating the histograms");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // The ranks on one node share the job's memory limit
+    MPI_Comm node_comm;
+    int node_ranks;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_ranks);
+    MPI_Comm_free(&node_comm);
+    if (config.stats != 0)
+    {
+        // Every line's results are fused_stats.fields wide from here on
+        line_stats_init(&fused_stats, config.stats);
+        batch_value_fields = fused_stats.fields;
+    }
+    if (config.output == OUTPUT_BINARY)
+    {
+        // format_lines packs records instead of text from here on
+        results_schema_init(&binary_schema, config.stats, config.histogram_path != NULL ? "letters" : "max");
+        out_binary = &binary_schema;
+    }
+    batch_sizer_init(&sizer, config.mem_budget, node_ranks, config.depth, config.batch_lines);
+
+    // Tracks for the main thread (thread 0 of the team), the rest of the team, and the reader and writer on rank 0
+    if (trace_open(config.metrics_path, config.trace_path, config.threads + 2, w_rank) != 0)
+    {
+        perror("Error allocating the trace");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    trace_thread("main", -1);
+
+    // In mmap mode every rank maps the dump itself (it lives on the shared
+    // filesystem), so only each rank's slice of the line index is sent
+    // (--read=parallel does its own pread and ignores --mmap and --uring)
+    if (config.read_parallel)
+    {
+        config.use_mmap = 0;
+        config.use_uring = 0;
+    }
+
+    if (config.use_mmap)
+    {
+        if (mapped_input_open(&input_map, config.input_path) != 0)
+        {
+            perror("Error mapping file");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    if (chunk_init(&chunk, w_size) != 0 || results_init(&results[0], w_size) != 0 ||
+        results_init(&results[1], w_size) != 0)
+    {
+        perror("Error allocating memory for the MPI chunks");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
     // Check if the process is the master
     if (w_rank == 0)
     {
         // NOTE: Master rank distributes the processes to other ranks
 
-        // Check the number of arguments
-        if (argc != 2)
+        // Pick the max_byte kernel for this CPU before any thread uses it
+        max_byte_isa();
+
+        // Line 0, --start found through the line index, or the checkpoint with --resume
+        uint64_t start_offset;
+        if (run_start(&config, &checkpoint, &start_index, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1, &start_offset) != 0)
         {
-            perror("Too many arguments, please use 2");
+            perror("Error finding the start line");
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        // Start the clock
-        clock_gettime(CLOCK_MONOTONIC, &start);
+        // Past the blocks a --cache run still has the results of
+        if (result_cache_open(&cache, &config, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1, &start_offset) != 0)
+        {
+            perror("Error opening the result cache");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-        // Read the wiki_dump.txt file
-        FILE *fp;
-        char *file_path = "/homes/dan/625/wiki_dump.txt";
+        if (config.use_mmap)
+            mapped_input_seek(&input_map, start_offset);
 
-        fp = fopen(file_path, "r");
-        if (fp == NULL)
+        // A resumed or cached run appends to the output of the last one, headers and all
+        int headers_written = checkpoint_continues_output(&checkpoint) || result_cache_continues_output(&cache);
+        // The binary line count is patched in the cached run's header; after --resume it
+        // stays unknown, the killed run never wrote it
+        if (result_cache_continues_output(&cache))
+            binary_schema.start = result_cache_output_start(&cache);
+
+        // The record header and schema ahead of binary results
+        if (!headers_written && config.output == OUTPUT_BINARY && results_write_header(STDOUT_FILENO, &binary_schema, config.start) != 0)
         {
-            perror("Error opening file");
+            perror("Error writing results");
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        // number of lines read so far
-        long total_lines = 0;
-
-        // while not end of file, process the wiki dump
-        while (total_lines < LINES_TO_READ)
+        // Column names ahead of the results when --stats picks them
+        if (!headers_written && config.stats != 0 && config.output == OUTPUT_TEXT &&
+            line_stats_write_schema(STDOUT_FILENO, config.stats) != 0)
         {
-            long lines_remaining = LINES_TO_READ - total_lines;
-            long batch_size = lines_remaining < MAX_LINES_IN_BATCH ? lines_remaining : MAX_LINES_IN_BATCH;
+                perror("Error writing results");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-            // most likely need to get rid of init arrays for a function that distributes lines to all the workers
-            lines_in_batch = init_arrays(fp, batch_size);
+        // Start the clock
+        clock_gettime(CLOCK_MONOTONIC, &start);
 
-            // if 0 lines are in the batch, we are at the end of the file
-            if (lines_in_batch == 0)
+        // The reused results when stdout does not hold them already
+        if (result_cache_replay(&cache, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+        {
+            perror("Error writing results");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        if (config.read_parallel)
+        {
+            read_own_range();
+        }
+        else
+        {
+            if (config.use_stream)
             {
-                break;
+                if (stream_input_open(&input_stream, STDIN_FILENO, config.block_size, STREAM_BLOCKS) != 0)
+                {
+                    perror("Error starting the input stream");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+            }
+            else if (config.use_uring)
+            {
+                if (stream_input_open_file(&input_stream, config.input_path, start_offset, config.block_size, config.queue_depth) != 0)
+                {
+                    perror("Error starting the io_uring reader");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+            }
+            else if (!config.use_mmap)
+            {
+                input_fp = fopen(config.input_path, "r");
+                if (input_fp == NULL)
+                {
+                    perror("Error opening file");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                if (fseeko(input_fp, start_offset, SEEK_SET) != 0)
+                {
+                    perror("Error seeking to the start line");
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                input_pos = start_offset;
             }
 
-            MPI_Bcast(&lines_in_batch, 1, MPI_LONG, 0, MPI_COMM_WORLD);
-
-            for (long i = 0; i < lines_in_batch; i++)
+            // Read batch N+1 and print batch N-1 while the ranks work on batch N
+            if (pipeline_run(config.depth, sizer.max_lines, config.start, read_batch, distribute_batch, complete_batch,
+                             print_results, &stats) != 0)
             {
-                MPI_Bcast(char_array[i], strlen(char_array[i]), MPI_CHAR, 0, MPI_COMM_WORLD);
+                perror("Error starting the pipeline");
+                MPI_Abort(MPI_COMM_WORLD, 1);
             }
 
-            process_batch_mpi(total_lines, w_rank, w_size);
+            // Close and Free Memory
+            if (config.use_stream || config.use_uring)
+                stream_input_close(&input_stream);
+            else if (!config.use_mmap)
+                fclose(input_fp);
 
-            total_lines += lines_in_batch;
+            // Tell the other ranks the input is done
+            chunk_scatter(&chunk, NULL, !config.use_mmap, MPI_COMM_WORLD);
+        }
 
-            free(char_array);
-            free(max_values);
+        if (checkpoint_finish(&checkpoint) != 0)
+        {
+            perror("Error writing the checkpoint");
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        // Close and Free Memory
-        fclose(fp);
+        if (result_cache_finish(&cache, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+        {
+            perror("Error writing the result cache");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-        lines_in_batch = 0;
-        MPI_Bcast(&lines_in_batch, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+        // Every record is out, fill in the line count
+        if (config.output == OUTPUT_BINARY && results_finish(STDOUT_FILENO, &binary_schema) != 0)
+        {
+            perror("Error writing results");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
         // Get the end time and CPU Usage
         clock_gettime(CLOCK_MONOTONIC, &end);
         getrusage(RUSAGE_SELF, &usage);
 
         // Open text file to write the resulting clock time and cpu usage
-        char *file_path_2 = args[1];
-        FILE *fp2 = fopen(file_path_2, "w");
+        FILE *fp2 = fopen(config.times_path, "w");
         if (fp2 == NULL)
         {
             perror("Error opening file");
@@ -229,41 +850,71 @@ int main(int argc, char *args[])
 
         // Write the stats to the text file
         fprintf(fp2, "Time: %.6fs CPU: %.2f%%", diff_time, cpu_percent);
+        if (!config.read_parallel)
+            pipeline_report(fp2, &stats);
+        fprintf(fp2, " Kernel: %s", max_byte_isa());
+        if (config.threads > 1)
+            schedule_report(fp2, config.schedule, worker_stats, config.threads);
+        if (config.use_stream || config.use_uring)
+            stream_input_report(fp2, &input_stream);
+        batch_sizer_report(fp2, &sizer);
+        config_report(fp2, &config);
+        checkpoint_report(fp2, &checkpoint);
+        result_cache_report(fp2, &cache);
+        if (start_index.offsets != NULL)
+            line_index_report(fp2, &start_index);
+        line_index_free(&start_index);
+        result_cache_free(&cache);
 
         fclose(fp2);
     }
+    else if (config.read_parallel)
+    {
+        read_own_range();
+    }
     else
     {
         while (1)
         {
-            MPI_Bcast(&lines_in_batch, 1, MPI_LONG, 0, MPI_COMM_WORLD);
-
+            // The gather that last used this buffer (two batches back) has to be done first
+            mpi_results *res = &results[batches_started++ % 2];
+            double traced = trace_begin();
+            results_wait(res);
+            trace_end(PHASE_GATHER, traced);
+
+            // Receive this rank's slice until rank 0 sends an empty batch
+            traced = trace_begin();
+            long lines_in_batch = chunk_scatter(&chunk, NULL, !config.use_mmap, MPI_COMM_WORLD);
+            trace_end(PHASE_SCATTER, traced);
             if (lines_in_batch == 0)
-            {
                 break;
-            }
 
-            char_array = malloc(lines_in_batch * sizeof(char *));
-            max_values = malloc(lines_in_batch * sizeof(int));
+            trace_count(COUNTER_LINES, chunk.lines);
+            trace_count(COUNTER_BYTES, chunk.lines > 0 ? chunk.line_offsets[chunk.lines] : 0);
+            trace_count(COUNTER_BATCHES, 1);
 
-            for (long i = 0; i < lines_in_batch; i++)
-            {
-                char_array[i] = malloc(MAX_LINES_IN_BATCH * sizeof(char));
-                MPI_Bcast(char_array[i], MAX_LINES_IN_BATCH, MPI_CHAR, 0, MPI_COMM_WORLD);
-            }
+            int *values = chunk_values(res, NULL);
+            process_batch_mpi(values);
+            gather_chunk(res, values, NULL);
 
-            process_batch_mpi(0, w_rank, w_size);
-
-            for (long i = 0; i < lines_in_batch; i++)
-            {
-                free(char_array[i]);
-            }
-
-            free(char_array);
-            free(max_values);
+            // Lines below the last one in this chunk are done on this rank too
+            if (config.use_mmap && chunk.lines > 0)
+                mapped_input_release(&input_map, chunk.file_offset + chunk.line_offsets[chunk.lines]);
         }
     }
 
+    if (histograms != NULL)
+        close_histogram();
+    close_trace();
+    free(worker_stats);
+
+    chunk_free(&chunk);
+    results_free(&results[0]);
+    results_free(&results[1]);
+
+    if (config.use_mmap)
+        mapped_input_close(&input_map);
+
     MPI_Finalize();
     return 0;
 }
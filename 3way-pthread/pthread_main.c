@@ -2,156 +2,363 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/resource.h>
 
-#define NUM_THREADS 8 // Number of threads to use
-#define LINES_TO_READ 100000 // Initial allocation size for lines (change for each number of lines)
-#define MAX_LINES_IN_BATCH 1000
+#include "mapped_input.h"
+#include "batch_sizer.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "histogram.h"
+#include "line_index.h"
+#include "line_stats.h"
+#include "max_byte.h"
+#include "out_writer.h"
+#include "pipeline.h"
+#include "result_cache.h"
+#include "results_file.h"
+#include "schedule.h"
+#include "stream_input.h"
+#include "topology.h"
+#include "trace.h"
+
+#define LINES_TO_READ 100000 // Default for --lines
 
 // Global arrays and variables
-char **char_array; // Array of strings (lines from the file)
-int *max_values; // Array to store max ASCII values per line
-long total_lines = 0; // Total number of lines read from the file
-long lines_in_batch;
+run_config config; // Settings from the command line
+batch_sizer sizer; // Lines per batch, from the memory budget
+line_batch *current_batch; // Batch the pool is currently working on
+atomic_long next_line; // Next unclaimed line of the batch (dynamic schedule)
+thread_stats *worker_stats; // Busy and idle time of each worker
+byte_histogram *histograms; // Byte counts of each worker (--histogram), NULL otherwise
+line_stats fused_stats; // Fused kernel for the --stats results
+results_schema binary_schema; // Record layout of --output=binary
+run_checkpoint checkpoint; // Where the run started and --checkpoint progress
+line_index start_index; // Sidecar index that found --start, empty otherwise
+result_cache cache; // Results of the unchanged start of the dump (--cache)
+cpu_topology topology; // Cores and NUMA nodes from /sys
+thread_placement placement; // CPU and node of each worker (--pin)
+
+FILE *input_fp; // Input file (getline mode)
+size_t input_pos = 0; // File offset of the next line (getline mode)
+stream_input input_stream; // Standard input read in blocks (input "-")
+
+// Memory-mapped input (--mmap)
+mapped_input input_map; // Mapping of the whole input file
+
+// Persistent thread pool
+// Workers are created once and park on batch_ready between batches,
+// instead of being created and joined again for every 1000-line batch
+pthread_t *pool_threads;
+pthread_barrier_t batch_ready; // Main thread + workers: a new batch is published
+pthread_barrier_t batch_done;  // Main thread + workers: every chunk of the batch is finished
+int pool_shutdown = 0;         // Set before the last batch_ready to make the workers exit
+
+// Seconds on the monotonic clock
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / (1e9);
+}
 
-// THREAD WORKER FUNCTION
-// Each thread executes this function. It processes a chunk of the lines
+// PROCESS LINES
+// Computes the maximum ASCII value (or the letter count with --histogram,
+// or the --stats results) of lines [start, end) of the current batch and
+// renders them as output part part while they are still in cache
+void process_lines(long thread_id, int part, long start, long end)
+{
+    const char *bytes = current_batch->bytes;
+    const uint32_t *line_offsets = current_batch->line_offsets;
+    int *max_values = current_batch->max_values;
+
+    double traced = trace_begin();
+    if (histograms != NULL)
+    {
+        histogram_lines(&histograms[thread_id], max_values, bytes, line_offsets, start, end);
+    }
+    else if (config.stats != 0)
+    {
+        line_stats_lines(&fused_stats, max_values, bytes, line_offsets, start, end);
+    }
+    else
+    {
+        for (long i = start; i < end; i++) 
+        {
+            // Find the max ASCII value with the vector kernel
+            max_values[i] = max_byte(bytes + line_offsets[i], line_offsets[i + 1] - line_offsets[i]);
+        }
+    }
+    trace_end(PHASE_KERNEL, traced);
+
+    traced = trace_begin();
+    format_batch_range(current_batch, part, start, end);
+    trace_end(PHASE_FORMAT, traced);
+}
+
+// PROCESS CHUNK
+// Processes this thread's chunk of the current batch
 // and computes the maximum ASCII value per line.
+void process_chunk(long thread_id)
+{
+    long lines_in_batch = current_batch->lines;
+    long start, end;
+
+    if (config.schedule == SCHEDULE_DYNAMIC)
+    {
+        // Keep claiming a cache line worth of lines until none are left
+        while ((start = atomic_fetch_add(&next_line, VALUES_PER_CACHE_LINE)) < lines_in_batch)
+        {
+            end = start + VALUES_PER_CACHE_LINE < lines_in_batch ? start + VALUES_PER_CACHE_LINE : lines_in_batch;
+            process_lines(thread_id, start / VALUES_PER_CACHE_LINE, start, end);
+            worker_stats[thread_id].lines += end - start;
+            worker_stats[thread_id].bytes += current_batch->line_offsets[end] - current_batch->line_offsets[start];
+        }
+    }
+    else
+    {
+        // Divide the work among threads evenly, by lines or by bytes
+        schedule_part(config.schedule, current_batch, thread_id, config.threads, &start, &end);
+        process_lines(thread_id, thread_id, start, end);
+        worker_stats[thread_id].lines += end - start;
+        worker_stats[thread_id].bytes += current_batch->line_offsets[end] - current_batch->line_offsets[start];
+    }
+}
+
+// THREAD WORKER FUNCTION
+// Each pool thread executes this function for the whole run. It waits for
+// a batch, processes its chunk, and reports back on the done barrier.
 void *thread_worker(void *arg) 
 {
     long thread_id = (long)arg;
 
-    // Divide the work among threads evenly
-    //long lines_per_thread = total_lines / NUM_THREADS;
-    long lines_per_thread = lines_in_batch / NUM_THREADS;
-    long start = thread_id * lines_per_thread;
-    long end = (thread_id == NUM_THREADS - 1) ? lines_in_batch : start + lines_per_thread;
+    trace_thread("worker", thread_id);
+    if (topology_pin(&placement, thread_id) != 0)
+        perror("Error pinning a worker, it runs unpinned");
 
-    // Process each line assigned to this thread
-    for (long i = start; i < end; i++) 
+    while (1)
     {
-        int max = 0;
-
-        // Go through each character in the line to find the max ASCII value
-        for (char *p = char_array[i]; *p != '\0'; p++) 
-        {
-            if ((int)(*p) > max) 
-            {
-                max = (int)(*p);
-            }
-        }
+        pthread_barrier_wait(&batch_ready);
+        if (pool_shutdown)
+            break;
 
-        // Store the max value for this line
-        max_values[i] = max;
+        double start = now();
+        process_chunk(thread_id);
+        if (histograms != NULL)
+            histogram_fold(&histograms[thread_id]);
+        double finish = now();
+
+        // Idle until the slowest worker is done with the batch
+        double traced = trace_begin();
+        pthread_barrier_wait(&batch_done);
+        trace_end(PHASE_BARRIER, traced);
+        worker_stats[thread_id].busy += finish - start;
+        worker_stats[thread_id].idle += now() - finish;
     }
 
     // Exit thread
     pthread_exit(NULL);
 }
 
-// PRINT RESULTS (and free memory)
-// Output format: line_number: max_ascii_value
-void print_results(long offset) 
+// START POOL
+// Creates the worker threads once for the whole run
+void start_pool()
 {
-    for (long i = 0; i < lines_in_batch; i++) 
+    pool_threads = malloc(config.threads * sizeof(pthread_t));
+    worker_stats = aligned_alloc(CACHE_LINE, config.threads * sizeof(thread_stats));
+    if (pool_threads == NULL || worker_stats == NULL)
     {
-        printf("%ld: %d\n", i+offset, max_values[i]);
-        free(char_array[i]);
+        perror("Error allocating the thread pool");
+        exit(1);
     }
-}
+    memset(worker_stats, 0, config.threads * sizeof(thread_stats));
 
-// Process the data in batches
-// Gives the program the ability read in file even when the program has only 1GB of memory available
-void process_batch(long offset)
-{
-    pthread_t threads[NUM_THREADS];
+    pthread_barrier_init(&batch_ready, NULL, config.threads + 1);
+    pthread_barrier_init(&batch_done, NULL, config.threads + 1);
 
-    for(long i = 0; i < NUM_THREADS; i++)
+    for(long i = 0; i < config.threads; i++)
     {
-         if (pthread_create(&threads[i], NULL, thread_worker, (void *)i) != 0) 
+        if (pthread_create(&pool_threads[i], NULL, thread_worker, (void *)i) != 0) 
         {
             perror("Error creating thread");
             exit(1);
         }
     }
-    for(long i = 0; i < NUM_THREADS; i++)
+}
+
+// STOP POOL
+// Wakes the workers one last time so they exit, then joins them
+void stop_pool()
+{
+    pool_shutdown = 1;
+    pthread_barrier_wait(&batch_ready);
+
+    for(long i = 0; i < config.threads; i++)
     {
-        // Wait for all threads to join
-        pthread_join(threads[i], NULL);
+        pthread_join(pool_threads[i], NULL);
     }
 
-    print_results(offset);
+    pthread_barrier_destroy(&batch_ready);
+    pthread_barrier_destroy(&batch_done);
+    free(pool_threads);
+}
+
+// PRINT RESULTS
+// Output format: line_number: max_ascii_value
+// Runs on the pipeline's writer thread while the next batch is computed
+void print_results(line_batch *batch) 
+{
+    // The workers already rendered the text, one writev sends every part
+    // Keep the results and the hash of the batch's bytes for the next run
+    if (result_cache_record(&cache, batch, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+    {
+        perror("Error writing the result cache");
+        exit(1);
+    }
+
+    if (config.output != OUTPUT_NONE && write_batch_output(batch, STDOUT_FILENO) != 0)
+    {
+        perror("Error writing results");
+        exit(1);
+    }
+
+    // Every line before the next batch is written now
+    if (checkpoint_save(&checkpoint, batch->offset + batch->lines, batch->file_offset + batch->line_offsets[batch->lines],
+                        config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+    {
+        perror("Error writing the checkpoint");
+        exit(1);
+    }
+
+    if (config.use_mmap)
+    {
+        // Every line up to the end of this batch is done
+        mapped_input_release(&input_map, batch->file_offset + batch->line_offsets[batch->lines]);
+    }
+}
+
+// Process the data in batches
+// Gives the program the ability read in file even when the program has only 1GB of memory available
+void process_batch(line_batch *batch)
+{
+    // One output region per worker (or per claimed chunk)
+    if (batch_output_reserve(batch, schedule_parts(config.schedule, batch->lines, config.threads)) != 0)
+    {
+        perror("Error allocating memory for the batch output");
+        exit(1);
+    }
+
+    // Each worker's part of the line bytes on its own node
+    topology_place_batch(&placement, &topology, batch, config.schedule);
+
+    // Publish the batch to the pool
+    current_batch = batch;
+    atomic_store(&next_line, 0);
+
+    pthread_barrier_wait(&batch_ready);
+
+    // Wait for all threads to finish their chunk
+    pthread_barrier_wait(&batch_done);
 }
 
 // INITIALIZE ARRAYS
-// Reads the file line-by-line into dynamically allocated char_array
-long init_arrays(FILE *fp, long lines_remaining) 
+// Reads the file line-by-line into the batch's bytes and line_offsets,
+// stopping after lines_remaining lines or once max_bytes bytes are in
+long init_arrays(FILE *fp, line_batch *batch, long lines_remaining, size_t max_bytes) 
 {
     
     char *line = NULL;
     size_t len = 0;
     ssize_t read;
-    size_t char_array_size = MAX_LINES_IN_BATCH;
 
     long lines_read = 0;
-    //keep track of memory usage to reduce freezing
-
-    // Allocate initial space for char_array
-    char_array = malloc(char_array_size * sizeof(char *));
-    max_values = malloc(char_array_size * sizeof(int));
 
-    if (char_array == NULL || max_values == NULL) 
-    {
-        perror("Error allocating memory for char_array or max_values");
-        exit(1);
-    }
+    batch->file_offset = input_pos;
+    batch->line_offsets[0] = 0;
+    batch->zeroed = 0;
     
     // Read each line from the file
-    while ((read = getline(&line, &len, fp)) != -1) 
+    while (lines_read < lines_remaining && batch->arena.used < max_bytes && (read = getline(&line, &len, fp)) != -1) 
     {
-        // Resize char_array if necessary
-        if (lines_read >= (long)char_array_size) 
+        // Append the line to the batch's bytes, offsets stay valid when the arena grows
+        if (batch->arena.used + read > UINT32_MAX)
         {
-            char_array_size *= 2;
-            char **temp = realloc(char_array, char_array_size * sizeof(char *));
-            int *temp_max = realloc(max_values, char_array_size * sizeof(int));
-            if (temp == NULL || temp_max == NULL) 
-            {
-                perror("Error reallocating memory");
-                exit(1);
-            }
-            char_array = temp;
-            max_values = temp_max;
-
-            // Initialize memory for new character and integers being read in
-            memset(char_array + lines_read, 0, (char_array_size - lines_read) * sizeof(char*));
-            memset(max_values + lines_read, 0, (char_array_size - lines_read) * sizeof(int));
+            fprintf(stderr, "Error: a batch holds at most 4 GiB of lines\n");
+            exit(1);
         }
-        // Allocate space for the line and copy it in
-        char_array[lines_read] = malloc(read + 1);
 
-        if (char_array[lines_read] == NULL) 
+        char *copy = arena_alloc(&batch->arena, read);
+        if (copy == NULL)
         {
             perror("Error allocating line memory");
             exit(1);
         }
 
-        // load pages into RAM
-        memset(char_array[lines_read], 0, read + 1);
-        snprintf(char_array[lines_read], read + 1, "%s", line);
-        lines_read++;
+        // Copied as a C string, so anything after an embedded NUL reads as 0
+        size_t copied = strnlen(line, read);
+        memcpy(copy, line, copied);
+        memset(copy + copied, 0, read - copied);
+        batch->zeroed |= copied < (size_t)read;
 
-        if(lines_read >= lines_remaining)
-            break;
+        input_pos += read;
+        lines_read++;
+        batch->line_offsets[lines_read] = batch->arena.used;
     }
    
+    // The arena only moves while lines are appended, its final place holds them all
+    batch->bytes = batch->arena.base;
+
     // Clean up
     free(line);
     return lines_read;
 }
 
+// READ BATCH
+// Pipeline reader stage: fills the next batch with getline, from the mapping or from the stream
+long read_batch(line_batch *batch)
+{
+    long lines_remaining = config.lines - (batch->offset - config.start);
+    long batch_size = batch_sizer_next(&sizer, batch);
+
+    if (lines_remaining < batch_size)
+        batch_size = lines_remaining;
+    if (batch_size <= 0)
+        return 0;
+
+    if (config.use_mmap)
+    {
+        int has_nul;
+        long lines = mapped_input_index(&input_map, batch->line_offsets, batch_size, sizer.target_bytes,
+                                        &batch->file_offset, &has_nul);
+        batch->bytes = input_map.data + batch->file_offset;
+        batch->zeroed = 0;
+
+        // The mapping is read-only, a line that getline would cut at a NUL goes through a copy
+        if (has_nul && batch_copy_lines(batch, lines) != 0)
+        {
+            perror("Error allocating line memory");
+            exit(1);
+        }
+        return lines;
+    }
+
+    if (config.use_stream || config.use_uring)
+    {
+        long lines = stream_input_read(&input_stream, batch, batch_size, sizer.target_bytes);
+        if (lines < 0)
+        {
+            perror("Error reading the input");
+            exit(1);
+        }
+        return lines;
+    }
+
+    return init_arrays(input_fp, batch, batch_size, sizer.target_bytes);
+}
+
 // MAIN FUNCTION
 // Controls program flow: setup, thread management, output, cleanup
 int main(int argc, char *args[]) 
@@ -159,60 +366,194 @@ int main(int argc, char *args[])
     // Structs to hold the time and usage
     struct timespec start, end;
     struct rusage usage;
+    pipeline_stats stats;
+
+    // Settings from the command line
+    config_init(&config, LINES_TO_READ);
+    if (config_parse(&config, argc, args, CONFIG_THREADS | CONFIG_SCHEDULE | CONFIG_PIN) != 0)
+        exit(1);
+    if (config.stats != 0)
+    {
+        // Every line's results are fused_stats.fields wide from here on
+        line_stats_init(&fused_stats, config.stats);
+        batch_value_fields = fused_stats.fields;
+    }
+    if (config.output == OUTPUT_BINARY)
+    {
+        // format_lines packs records instead of text from here on
+        results_schema_init(&binary_schema, config.stats, config.histogram_path != NULL ? "letters" : "max");
+        out_binary = &binary_schema;
+    }
+    batch_sizer_init(&sizer, config.mem_budget, 1, config.depth, config.batch_lines);
+
+    // Cores and NUMA nodes, and the CPU of every worker for --pin
+    topology_discover(&topology);
+    if (topology_plan(&topology, config.pin, config.threads, &placement) != 0)
+    {
+        perror("Error allocating the thread placement");
+        exit(1);
+    }
+
+    // Tracks for the workers, the reader and the writer
+    if (trace_open(config.metrics_path, config.trace_path, config.threads + 2, 0) != 0)
+    {
+        perror("Error allocating the trace");
+        exit(1);
+    }
+
+    // Pick the max_byte kernel for this CPU before any thread uses it
+    max_byte_isa();
+
+    // Line 0, --start found through the line index, or the checkpoint with --resume
+    uint64_t start_offset;
+    if (run_start(&config, &checkpoint, &start_index, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1, &start_offset) != 0)
+    {
+        perror("Error finding the start line");
+        exit(1);
+    }
+
+    // Past the blocks a --cache run still has the results of
+    if (result_cache_open(&cache, &config, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1, &start_offset) != 0)
+    {
+        perror("Error opening the result cache");
+        exit(1);
+    }
+
+    // A resumed or cached run appends to the output of the last one, headers and all
+    int headers_written = checkpoint_continues_output(&checkpoint) || result_cache_continues_output(&cache);
+    // The binary line count is patched in the cached run's header; after --resume it
+    // stays unknown, the killed run never wrote it
+    if (result_cache_continues_output(&cache))
+        binary_schema.start = result_cache_output_start(&cache);
+
+    // The record header and schema ahead of binary results
+    if (!headers_written && config.output == OUTPUT_BINARY && results_write_header(STDOUT_FILENO, &binary_schema, config.start) != 0)
+    {
+        perror("Error writing results");
+        exit(1);
+    }
 
-    // Check the number of arguments
-    if(argc > 2)
+    // Column names ahead of the results when --stats picks them
+    if (!headers_written && config.stats != 0 && config.output == OUTPUT_TEXT &&
+        line_stats_write_schema(STDOUT_FILENO, config.stats) != 0)
     {
-        perror("Too many arguments, please use 2");
+        perror("Error writing results");
         exit(1);
     }
 
     // Start the clock
     clock_gettime(CLOCK_MONOTONIC, &start);
 
-    //Read the wiki_dump.txt file
-    FILE *fp;
-    char *file_path = "/homes/dan/625/wiki_dump.txt";
-
-    fp = fopen(file_path, "r");
-    if (fp == NULL)
+    // The reused results when stdout does not hold them already
+    if (result_cache_replay(&cache, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
     {
-        perror("Error opening file");
+        perror("Error writing results");
         exit(1);
     }
+
+    if (config.use_mmap)
+    {
+        if (mapped_input_open(&input_map, config.input_path) != 0)
+        {
+            perror("Error mapping file");
+            exit(1);
+        }
+        mapped_input_seek(&input_map, start_offset);
+    }
+    else if (config.use_stream)
+    {
+        if (stream_input_open(&input_stream, STDIN_FILENO, config.block_size, STREAM_BLOCKS) != 0)
+        {
+            perror("Error starting the input stream");
+            exit(1);
+        }
+    }
+    else if (config.use_uring)
+    {
+        if (stream_input_open_file(&input_stream, config.input_path, start_offset, config.block_size, config.queue_depth) != 0)
+        {
+            perror("Error starting the io_uring reader");
+            exit(1);
+        }
+    }
+    else
+    {
+        input_fp = fopen(config.input_path, "r");
+        if (input_fp == NULL)
+        {
+            perror("Error opening file");
+            exit(1);
+        }
+        if (fseeko(input_fp, start_offset, SEEK_SET) != 0)
+        {
+            perror("Error seeking to the start line");
+            exit(1);
+        }
+        input_pos = start_offset;
+    }
     
-    // number of lines read so far
-   long total_lines = 0;
-
-   //while not end of file, process the wiki dump
-   while(total_lines < LINES_TO_READ)
-   {
-        long lines_remaining = LINES_TO_READ - total_lines;
-        long batch_size = lines_remaining < MAX_LINES_IN_BATCH ? lines_remaining : MAX_LINES_IN_BATCH;
-        lines_in_batch = init_arrays(fp, batch_size);
-
-        //if 0 lines are in the batch, we are at the end of the file 
-        if(lines_in_batch == 0)
-            break;
-        process_batch(total_lines);
+    if (config.histogram_path != NULL && (histograms = histogram_alloc(config.threads)) == NULL)
+    {
+        perror("Error allocating the histograms");
+        exit(1);
+    }
+
+    // Workers live for the whole run
+    start_pool();
 
-        //update the number of total lines
-        total_lines += lines_in_batch;
+    // Read batch N+1 and print batch N-1 while the pool works on batch N
+    if (pipeline_run(config.depth, sizer.max_lines, config.start, read_batch, process_batch, NULL, print_results, &stats) != 0)
+    {
+        perror("Error starting the pipeline");
+        exit(1);
+    }
 
-        free(char_array);
-        free(max_values);
-   }
+    stop_pool();
+
+    if (histograms != NULL)
+    {
+        histogram_merge(histograms, config.threads);
+        if (histogram_write(config.histogram_path, histograms[0].total) != 0)
+        {
+            perror("Error writing the histogram");
+            exit(1);
+        }
+        free(histograms);
+    }
+
+    if (checkpoint_finish(&checkpoint) != 0)
+    {
+        perror("Error writing the checkpoint");
+        exit(1);
+    }
+
+    if (result_cache_finish(&cache, config.output != OUTPUT_NONE ? STDOUT_FILENO : -1) != 0)
+    {
+        perror("Error writing the result cache");
+        exit(1);
+    }
+
+    // Every record is out, fill in the line count
+    if (config.output == OUTPUT_BINARY && results_finish(STDOUT_FILENO, &binary_schema) != 0)
+    {
+        perror("Error writing results");
+        exit(1);
+    }
 
     // Close and Free Memory
-    fclose(fp);
+    if (config.use_mmap)
+        mapped_input_close(&input_map);
+    else if (config.use_stream || config.use_uring)
+        stream_input_close(&input_stream);
+    else
+        fclose(input_fp);
 
     // Get the end time and CPU Usage
     clock_gettime(CLOCK_MONOTONIC, &end);
     getrusage(RUSAGE_SELF, &usage);
 
     // Open text file to write the resulting clock time and cpu usage
-    char *file_path_2 = args[1];
-    FILE *fp2 = fopen(file_path_2, "w");
+    FILE *fp2 = fopen(config.times_path, "w");
     if(fp2 == NULL)
     {
         perror("Error opening file");
@@ -228,8 +569,30 @@ int main(int argc, char *args[])
 
     // Write the stats to the text file
     fprintf(fp2, "Time: %.6fs CPU: %.2f%%", diff_time, cpu_percent);
+    pipeline_report(fp2, &stats);
+    fprintf(fp2, " Kernel: %s", max_byte_isa());
+    schedule_report(fp2, config.schedule, worker_stats, config.threads);
+    topology_report(fp2, &topology, &placement, worker_stats);
+    if (config.use_stream || config.use_uring)
+        stream_input_report(fp2, &input_stream);
+    batch_sizer_report(fp2, &sizer);
+    config_report(fp2, &config);
+    checkpoint_report(fp2, &checkpoint);
+    result_cache_report(fp2, &cache);
+    if (start_index.offsets != NULL)
+        line_index_report(fp2, &start_index);
+    line_index_free(&start_index);
+    result_cache_free(&cache);
 
     fclose(fp2);
+    free(worker_stats);
+    topology_free(&placement);
+
+    if (trace_close(0, NULL, NULL) != 0)
+    {
+        perror("Error writing the metrics or trace file");
+        exit(1);
+    }
     return 0;
 }
 
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "out_writer.h"
+#include "results_file.h"
+
+// RESULTS CONVERTER
+// Reads a file written with --output=binary through results_map and writes
+// it back out as the text output of the same run, byte for byte, so
+//
+//     ./pthread-exc t --output=binary dump.txt > r.bin
+//     ./results-exc r.bin | cmp - <(./pthread-exc t dump.txt)
+//
+// checks the binary path against the text one. --info prints the header
+// and schema instead.
+
+#define CONVERT_LINES 65536 // Lines rendered per write
+
+// Header fields and column names on stdout
+static void print_info(const results_map *map)
+{
+    const results_header *header = map->header;
+
+    printf("Version: %u Lines: %lu First line: %lu Record: %u bytes Data: offset %u", header->version,
+           (unsigned long)map->lines, (unsigned long)header->first_line, header->record_size, header->data_offset);
+    if (header->lines == RESULTS_LINES_UNKNOWN)
+        printf(" (counted, written through a pipe)");
+    printf("\n");
+
+    for (uint32_t f = 0; f < header->fields; f++)
+    {
+        printf("  %-10.*s %u byte%s%s\n", RESULTS_NAME_MAX, map->fields[f].name, map->fields[f].width,
+               map->fields[f].width > 1 ? "s" : "", map->fields[f].is_signed ? " signed" : "");
+    }
+}
+
+// Text of every record on stdout, CONVERT_LINES at a time
+static int convert(const results_map *map)
+{
+    int fields = map->header->fields;
+    line_batch out = {0};
+
+    // format_lines renders fields values per line as text
+    batch_value_fields = fields;
+
+    // "# line: max min ..." first, as line_stats_write_schema writes it
+    if (map->header->flags & RESULTS_STATS)
+    {
+        printf("# line:");
+        for (int f = 0; f < fields; f++)
+            printf(" %.*s", RESULTS_NAME_MAX, map->fields[f].name);
+        printf("\n");
+    }
+    fflush(stdout);
+
+    int *values = malloc(CONVERT_LINES * fields * sizeof(int));
+    if (values == NULL)
+        return -1;
+
+    for (uint64_t first = 0; first < map->lines; first += CONVERT_LINES)
+    {
+        long lines = map->lines - first < CONVERT_LINES ? map->lines - first : CONVERT_LINES;
+
+        for (long i = 0; i < lines; i++)
+        {
+            for (int f = 0; f < fields; f++)
+                values[i * fields + f] = results_map_value(map, first + i, f);
+        }
+
+        out.offset = map->header->first_line + first;
+        out.lines = lines;
+        out.max_values = values;
+        if (batch_output_reserve(&out, 1) != 0)
+            return -1;
+        format_batch_part(&out, 0, 1);
+        if (write_batch_output(&out, STDOUT_FILENO) != 0)
+            return -1;
+    }
+
+    free(values);
+    free(out.output);
+    free(out.output_parts);
+    return 0;
+}
+
+int main(int argc, char *args[])
+{
+    int info = argc == 3 && strcmp(args[2], "--info") == 0;
+    results_map map;
+
+    if (argc != 2 && !info)
+    {
+        fprintf(stderr, "Usage: %s <results_file> [--info]\n", args[0]);
+        return 1;
+    }
+
+    if (results_map_open(&map, args[1]) != 0)
+    {
+        perror("Error opening results file");
+        return 1;
+    }
+
+    if (info)
+        print_info(&map);
+    else if (convert(&map) != 0)
+    {
+        perror("Error writing results");
+        return 1;
+    }
+
+    results_map_close(&map);
+    return 0;
+}